@@ -22,6 +22,16 @@ static void logCodegen(const std::string &str) {
 #endif
 }
 
+/* An array value the caller owns a reference to: a call returns one, the
+   value of a variable is borrowed and retained (see Codegen::createArrayStore) */
+static Value *createOwnedArrayIR(Codegen &context, ExprAST &expr, bool needPrintIR)
+{
+  Value *value = expr.createIR(context, needPrintIR);
+  if (value && dynamic_cast<IdentifierExprAST *>(&expr))
+    context.createArrayRetain(value);
+  return value;
+}
+
 /* codegen methods */
 Value *BlockExprAST::createIR(Codegen &context, bool needPrintIR)
 {
@@ -78,64 +88,101 @@ Value *StringExprAST::createIR(Codegen &context, bool _needPrintIR)
   return llvm::ConstantExpr::getBitCast(globalDeclaration, charType->getPointerTo());
 }
 
+SymbolID IdentifierExprAST::id(Codegen &context)
+{
+  if (ID == NoSymbol)
+    ID = context.Symbols.intern(Name);
+  return ID;
+}
+
 Value *IdentifierExprAST::createIR(Codegen &context, bool _needPrintIR)
 {
-  logCodegen("identifier reference " + Name);
+  logCodegen("identifier reference " + std::string(Name));
   CodegenBlock *TheBlock = context.GeneratingBlocks.top();
-  AllocaInst *Alloca = TheBlock->locals[Name];
+  AllocaInst *Alloca = TheBlock->locals.lookup(id(context));
+  if (Alloca)
+    return context.Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, Name);
 
-  if (!Alloca)
-  {
-    Alloca = context.NamedValues[Name];
-  }
+  // top-level variable of an earlier REPL input
+  if (GlobalVariable *Global = context.findGlobal(id(context)))
+    return context.Builder->CreateLoad(Global->getValueType(), Global, Name);
 
-  if (!Alloca)
-  {
-    std::cerr << "[AST] Undeclared variable " << Name << std::endl;
-    return nullptr;
-  }
-  return context.Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, Name.c_str());
+  std::cerr << "[AST] Undeclared variable " << Name << std::endl;
+  return nullptr;
 }
 
 Value *ExpressionStatementAST::createIR(Codegen &context, bool needPrintIR)
 {
-  return Statement.createIR(context, needPrintIR);
+  Value *value = Statement.createIR(context, needPrintIR);
+  // nothing holds the array a call returns here
+  if (value && dynamic_cast<CallExprAST *>(&Statement) && context.arrayElementType(value->getType()))
+    context.createArrayRelease(value);
+  return value;
 }
 
 Value *VarDeclExprAST::createIR(Codegen &context, bool needPrintIR)
 {
-  std::string name = Name.get();
+  std::string name(Name.get());
   logCodegen("variable declaration " + name);
   CodegenBlock *TheBlock = context.GeneratingBlocks.top();
-  AllocaInst *Alloca = context.createBlockAlloca(
-      TheBlock->block, context.stringTypeToLLVM(TypeName), name.c_str());
-  TheBlock->locals[name] = Alloca;
-
-  NameTable *Names = context.NameTypesByBlock.back();
-  (*Names)[name] = context.stringTypeToLLVM(TypeName);
+  Value *Address;
+  if (context.isReplTopLevel())
+    Address = context.defineGlobal(Name.id(context), name, context.stringTypeToLLVM(TypeName));
+  else if (context.arrayElementType(context.stringTypeToLLVM(TypeName)))
+  {
+    AllocaInst *Alloca = context.createArrayVariable(context.stringTypeToLLVM(TypeName), name);
+    TheBlock->locals[Name.id(context)] = Alloca;
+    Address = Alloca;
+  }
+  else
+  {
+    AllocaInst *Alloca = context.createBlockAlloca(
+        TheBlock->block, context.stringTypeToLLVM(TypeName), name.c_str());
+    TheBlock->locals[Name.id(context)] = Alloca;
+    Address = Alloca;
+  }
+  context.NameTypes.insert(Name.id(context), context.stringTypeToLLVM(TypeName));
 
   if (AssignmentExpr)
   {
     AssignmentAST assignment(Name, *AssignmentExpr);
     assignment.createIR(context, needPrintIR);
   }
-  return Alloca;
+  else if (llvm::Type *elementType = context.arrayElementType(context.stringTypeToLLVM(TypeName)))
+  {
+    // an array variable is never null, without a value it is empty
+    context.createArrayStore(
+      context.createArrayAllocation(elementType, context.Builder->getInt32(0)), Address);
+  }
+  return Address;
 }
 
 Value *AssignmentAST::createIR(Codegen &context, bool needPrintIR)
 {
-  logCodegen("assignment for " + LHS.Name);
+  logCodegen("assignment for " + std::string(LHS.Name));
   CodegenBlock *TheBlock = context.GeneratingBlocks.top();
 
-  AllocaInst *Alloca = TheBlock->locals[LHS.Name];
-  if (!Alloca)
+  Value *Address = nullptr;
+  llvm::Type *resultType = nullptr;
+  if (AllocaInst *Alloca = TheBlock->locals.lookup(LHS.id(context)))
+  {
+    Address = Alloca;
+    resultType = Alloca->getAllocatedType();
+  }
+  else if (GlobalVariable *Global = context.findGlobal(LHS.id(context)))
+  {
+    Address = Global;
+    resultType = Global->getValueType();
+  }
+  if (!Address)
   {
     std::cerr << "[AST] Undeclared variable " << LHS.Name << std::endl;
     return nullptr;
   }
 
-  Value *value = RHS.createIR(context, needPrintIR);
-  llvm::Type *resultType = Alloca->getAllocatedType();
+  bool isArray = context.arrayElementType(resultType);
+  Value *value = isArray ? createOwnedArrayIR(context, RHS, needPrintIR)
+                         : RHS.createIR(context, needPrintIR);
   if (RHS.typeOf(context) != resultType)
   {
     value = context.createTypeCast(context.Builder, value, resultType);
@@ -146,13 +193,157 @@ Value *AssignmentAST::createIR(Codegen &context, bool needPrintIR)
     std::cerr << "[AST] Not generated value for " << LHS.Name << std::endl;
     return nullptr;
   }
-  return context.Builder->CreateStore(value, Alloca);
+  if (isArray)
+    return context.createArrayStore(value, Address);
+  return context.Builder->CreateStore(value, Address);
+}
+
+/* the address is computed after the value: a[i] = f() may append to a */
+Value *IndexExprAST::createAddressIR(Codegen &context, bool needPrintIR)
+{
+  Value *index = Index.createIR(context, needPrintIR);
+  Value *array = Name.createIR(context, needPrintIR);
+  if (!index || !array)
+  {
+    std::cerr << "[AST] Empty codegen for element of " << Name.Name << std::endl;
+    return nullptr;
+  }
+  return context.createArrayElementAddress(array, index, typeOf(context));
+}
+
+Value *IndexExprAST::createIR(Codegen &context, bool needPrintIR)
+{
+  logCodegen("element of " + std::string(Name.Name));
+  Value *address = createAddressIR(context, needPrintIR);
+  if (!address)
+    return nullptr;
+  LoadInst *load = context.Builder->CreateLoad(typeOf(context), address, Name.Name);
+  load->setMetadata(LLVMContext::MD_tbaa, context.arrayTBAA(context.print(Name.typeOf(context))));
+  return load;
+}
+
+Value *IndexAssignmentAST::createIR(Codegen &context, bool needPrintIR)
+{
+  logCodegen("assignment for element of " + std::string(LHS.Name.Name));
+  Value *value = RHS.createIR(context, needPrintIR);
+  if (!value)
+  {
+    std::cerr << "[AST] Not generated value for element of " << LHS.Name.Name << std::endl;
+    return nullptr;
+  }
+  llvm::Type *elementType = typeOf(context);
+  if (RHS.typeOf(context) != elementType)
+    value = context.createTypeCast(context.Builder, value, elementType);
+
+  Value *address = LHS.createAddressIR(context, needPrintIR);
+  if (!address)
+    return nullptr;
+  StoreInst *store = context.Builder->CreateStore(value, address);
+  store->setMetadata(LLVMContext::MD_tbaa, context.arrayTBAA(context.print(LHS.Name.typeOf(context))));
+  return value;
+}
+
+Value *MemberExprAST::createIR(Codegen &context, bool needPrintIR)
+{
+  logCodegen("member " + std::string(Name.Name) + "." + std::string(Member.Name));
+  if (Member.Name == "length")
+  {
+    Value *array = Name.createIR(context, needPrintIR);
+    return array ? context.createArrayFieldLoad(array, ArrayLength) : nullptr;
+  }
+
+  // append: the value is stored behind the last element, a full array is grown first
+  llvm::Type *elementType = context.arrayElementType(Name.typeOf(context));
+  Value *value = Arguments[0]->createIR(context, needPrintIR);
+  Value *array = Name.createIR(context, needPrintIR);
+  if (!value || !array)
+  {
+    std::cerr << "[AST] Empty codegen for append to " << Name.Name << std::endl;
+    return nullptr;
+  }
+  if (Arguments[0]->typeOf(context) != elementType)
+    value = context.createTypeCast(context.Builder, value, elementType);
+
+  Value *length = context.createArrayFieldLoad(array, ArrayLength);
+  Value *maxLength = context.createArrayFieldLoad(array, ArrayMaxLength);
+  Value *isFull = context.Builder->CreateICmpSGE(length, maxLength, "isfull");
+  Function *TheFunction = context.currentFunction();
+  BasicBlock *GrowBB = BasicBlock::Create(*context.TheContext, "grow", TheFunction);
+  BasicBlock *AppendBB = BasicBlock::Create(*context.TheContext, "append", TheFunction);
+  BranchInst *branch = context.Builder->CreateCondBr(isFull, GrowBB, AppendBB);
+  branch->setMetadata(LLVMContext::MD_prof, MDBuilder(*context.TheContext).createBranchWeights(1, 1 << 20));
+
+  context.Builder->SetInsertPoint(GrowBB);
+  context.Builder->CreateCall(context.TheModule->getFunction("__array_grow"),
+    {context.Builder->CreateExtractValue(array, 0, "header")});
+  context.Builder->CreateBr(AppendBB);
+
+  context.Builder->SetInsertPoint(AppendBB);
+  Value *buf = context.createArrayFieldLoad(array, ArrayBuf);
+  Value *offset = context.Builder->CreateSExt(length, Type::getInt64Ty(*context.TheContext), "offset");
+  Value *address = context.Builder->CreateInBoundsGEP(elementType, buf, offset, "element");
+  StoreInst *store = context.Builder->CreateStore(value, address);
+  store->setMetadata(LLVMContext::MD_tbaa, context.arrayTBAA(context.print(Name.typeOf(context))));
+  Value *newLength = context.Builder->CreateNSWAdd(length, context.Builder->getInt32(1), "length");
+  context.createArrayFieldStore(array, ArrayLength, newLength);
+  return newLength;
+}
+
+/* IR builders indexed by BinaryOp, one column per operand type */
+typedef Value *(*BinaryOpBuilder)(IRBuilder<> &B, Value *L, Value *R);
+static const struct
+{
+  const char *Name;
+  BinaryOpBuilder Int;
+  BinaryOpBuilder Double;
+} BinaryOps[] = {
+  {"+",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateAdd(L, R, "iaddtmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFAdd(L, R, "addtmp"); }},
+  {"-",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateSub(L, R, "isubtmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFSub(L, R, "subtmp"); }},
+  {"*",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateMul(L, R, "imultmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFMul(L, R, "multmp"); }},
+  {"/",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateSDiv(L, R, "idivtmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFDiv(L, R, "divtmp"); }},
+  // comparison operators
+  {"==",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpEQ(L, R, "ieqtmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpOEQ(L, R, "eqtmp"); }},
+  {"!=",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpNE(L, R, "ineqtmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpONE(L, R, "neqtmp"); }},
+  {">",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpSGT(L, R, "igttmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpOGT(L, R, "gttmp"); }},
+  {">=",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpSGE(L, R, "igetmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpOGE(L, R, "getmp"); }},
+  {"<",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpSLT(L, R, "ilttmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpOLT(L, R, "lttmp"); }},
+  {"<=",
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateICmpSLE(L, R, "iletmp"); },
+   [](IRBuilder<> &B, Value *L, Value *R) { return B.CreateFCmpOLE(L, R, "letmp"); }},
+};
+
+const char *operatorName(BinaryOp op)
+{
+  return BinaryOps[static_cast<unsigned>(op)].Name;
+}
+
+const char *operatorName(UnaryOp op)
+{
+  return "-";
 }
 
 Value *BinaryExprAST::createIR(Codegen &context, bool needPrintIR)
 {
   /* integers are i32 and signed */
-  logCodegen("expression " + Op + ":");
+  logCodegen(std::string("expression ") + operatorName(Op) + ":");
   Value *L = LHS->createIR(context, needPrintIR);
   Value *R = RHS->createIR(context, needPrintIR);
   if (!L || !R)
@@ -175,85 +366,13 @@ Value *BinaryExprAST::createIR(Codegen &context, bool needPrintIR)
   }
 
   bool isDoubleType = needCastToDouble || doubleType == Ltype;
-  if (Op.compare("+") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFAdd(L, R, "addtmp")
-      : context.Builder->CreateAdd(L, R, "iaddtmp");
-    return L;
-  }
-  if (Op.compare("-") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFSub(L, R, "subtmp")
-      : context.Builder->CreateSub(L, R, "isubtmp");
-    return L;
-  }
-  if (Op.compare("*") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFMul(L, R, "multmp")
-      : context.Builder->CreateMul(L, R, "imultmp");
-    return L;
-  }
-  if (Op.compare("/") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFDiv(L, R, "divtmp")
-      : context.Builder->CreateSDiv(L, R, "idivtmp");
-    return L;
-  }
-  // comparison operators
-  if (Op.compare("==") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpOEQ(L, R, "eqtmp")
-      : context.Builder->CreateICmpEQ(L, R, "ieqtmp");
-    return L;
-  }
-  if (Op.compare("!=") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpONE(L, R, "neqtmp")
-      : context.Builder->CreateICmpNE(L, R, "ineqtmp");
-    return L;
-  }
-  if (Op.compare(">") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpOGT(L, R, "gttmp")
-      : context.Builder->CreateICmpSGT(L, R, "igttmp");
-    return L;
-  }
-  if (Op.compare(">=") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpOGE(L, R, "getmp")
-      : context.Builder->CreateICmpSGE(L, R, "igetmp");
-    return L;
-  }
-  if (Op.compare("<") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpOLT(L, R, "lttmp")
-      : context.Builder->CreateICmpSLT(L, R, "ilttmp");
-    return L;
-  }
-  if (Op.compare("<=") == 0)
-  {
-    L = isDoubleType
-      ? context.Builder->CreateFCmpOLE(L, R, "letmp")
-      : context.Builder->CreateICmpSLE(L, R, "iletmp");
-    return L;
-  }
-  std::cerr << "[AST] Operation " << Op << " not supported" << std::endl;
-  return nullptr;
+  auto &op = BinaryOps[static_cast<unsigned>(Op)];
+  return (isDoubleType ? op.Double : op.Int)(*context.Builder, L, R);
 }
 
-
 Value *UnaryExprAST::createIR(Codegen &context, bool needPrintIR)
 {
-  logCodegen("expression " + Op + ":");
+  logCodegen(std::string("expression ") + operatorName(Op) + ":");
   Value *Val = Expr->createIR(context, needPrintIR);
   if (!Val)
   {
@@ -262,28 +381,27 @@ Value *UnaryExprAST::createIR(Codegen &context, bool needPrintIR)
   }
 
   bool isDoubleType = Type::getDoubleTy(*context.TheContext) == Expr->typeOf(context);
-  if (Op.compare("-") == 0)
+  if (Op == UnaryOp::Neg)
   {
     Val = isDoubleType
             ? context.Builder->CreateFNeg(Val, "negation")
             : context.Builder->CreateNeg(Val, "negation");
     return Val;
   }
-  std::cerr << "[AST] Unary operation " << Op << " is not supported" << std::endl;
+  std::cerr << "[AST] Unary operation " << operatorName(Op) << " is not supported" << std::endl;
   return nullptr;
 }
 
 llvm::Type *FunctionDeclarationAST::getArgumentType(Codegen &context, int idx)
 {
-  return context.stringTypeToLLVM(Arguments[idx]->TypeName.get());
+  return context.stringTypeToLLVM(Arguments[idx]->TypeName);
 }
 
 Value *FunctionDeclarationAST::createIR(Codegen &context, bool needPrintIR)
 {
-  logCodegen("function " + Name.get());
+  logCodegen("function " + std::string(Name.get()));
   // the type casts refer to the name table
-  NameTable *Names = new NameTable();
-  context.NameTypesByBlock.push_back(Names);
+  NameScope scope(context.NameTypes);
   std::vector<llvm::Type *> argTypes;
   VariableList::const_iterator it;
   for (it = Arguments.begin(); it != Arguments.end(); it++)
@@ -291,12 +409,13 @@ Value *FunctionDeclarationAST::createIR(Codegen &context, bool needPrintIR)
     // types
     argTypes.push_back(context.stringTypeToLLVM((**it).TypeName));
     // nametable
-    (*Names)[(**it).Name.get()] = context.stringTypeToLLVM((**it).TypeName);
+    context.NameTypes.insert((**it).Name.id(context), context.stringTypeToLLVM((**it).TypeName));
   }
 
   FunctionType *FT = FunctionType::get(context.stringTypeToLLVM(TypeName), argTypes, false);
   Function *TheFunction = Function::Create(
       FT, GlobalValue::ExternalLinkage, Name.get(), context.TheModule.get());
+  context.setTargetAttributes(TheFunction);
   context.pushFunction(TheFunction);
 
   BasicBlock *bblock = BasicBlock::Create(*context.TheContext, "entry", TheFunction);
@@ -309,15 +428,29 @@ Value *FunctionDeclarationAST::createIR(Codegen &context, bool needPrintIR)
   unsigned idx = 0;
   for (auto &Arg : TheFunction->args())
   {
-    std::string name = Arguments[idx]->Name.get();
+    std::string name(Arguments[idx]->Name.get());
     AllocaInst *Alloca = context.createBlockAlloca(
         TheBlock->block, argTypes[idx], name);
 
     Arg.setName(name);
     context.Builder->CreateStore(&Arg, Alloca);
-    TheBlock->locals[name] = Alloca;
+    // the argument is borrowed, the variable holds a reference of its own
+    if (context.arrayElementType(argTypes[idx]))
+    {
+      context.createArrayRetain(&Arg);
+      TheBlock->arrays.push_back(Alloca);
+    }
+    TheBlock->locals[Arguments[idx]->Name.id(context)] = Alloca;
+    TheBlock->arguments.push_back(Alloca);
     idx++;
   }
+  context.beginFunctionProfile(TheFunction);
+
+  // self tail calls jump here; merged back into the entry block if unused
+  BasicBlock *tailRecurseBlock = BasicBlock::Create(*context.TheContext, "tailrecurse", TheFunction);
+  context.Builder->CreateBr(tailRecurseBlock);
+  context.Builder->SetInsertPoint(tailRecurseBlock);
+  TheBlock->tailRecurseBlock = tailRecurseBlock;
 
   Value *RetVal = Block.createIR(context, needPrintIR);
   llvm::Type *returnType = context.stringTypeToLLVM(TypeName);
@@ -326,15 +459,28 @@ Value *FunctionDeclarationAST::createIR(Codegen &context, bool needPrintIR)
     RetVal = context.createTypeCast(context.Builder, RetVal, returnType);
   }
 
-  context.optimize(TheFunction);
-  verifyFunction(*TheFunction);
+  context.releaseArrayVariables(TheFunction);
+  context.endFunctionProfile();
+  if (tailRecurseBlock->hasNPredecessors(1))
+    MergeBlockIntoPredecessor(tailRecurseBlock);
 
-  if (needPrintIR)
-    TheFunction->print(*context.out);
+  if (IsTailRecursive)
+  {
+    for (User *user : TheFunction->users())
+    {
+      CallInst *call = dyn_cast<CallInst>(user);
+      if (call && call->getFunction() == TheFunction)
+      {
+        std::cerr << "[AST] Function " << Name.get() << " is declared tailrec"
+          << " but a recursive call is not in tail position" << std::endl;
+        break;
+      }
+    }
+  }
+  verifyFunction(*TheFunction);
 
   context.popFunction();
   context.popBlock();
-  context.NameTypesByBlock.pop_back();
   if (!context.GeneratingBlocks.empty()) // stack is empty when we exit the main function
     context.Builder->SetInsertPoint(context.currentBlock());
   return TheFunction;
@@ -342,8 +488,8 @@ Value *FunctionDeclarationAST::createIR(Codegen &context, bool needPrintIR)
 
 Value *CallExprAST::createIR(Codegen &context, bool needPrintIR)
 {
-  logCodegen("function call " + Name.get());
-  Function *function = context.TheModule->getFunction(Name.get().c_str());
+  logCodegen("function call " + std::string(Name.get()));
+  Function *function = context.findCallee(Name.get());
   if (!function)
   {
     std::cerr << "[AST] Function " << Name.get() << " not found" << std::endl;
@@ -352,6 +498,20 @@ Value *CallExprAST::createIR(Codegen &context, bool needPrintIR)
   FunctionType *fnType = function->getFunctionType();
 
   std::vector<Value *> args;
+  if (!createArgumentsIR(context, fnType, args, needPrintIR))
+    return nullptr;
+  CallInst *call = context.Builder->CreateCall(function, args, Name.get());
+  // the arrays returned by calls in the arguments are only borrowed by this one
+  for (unsigned idx = 0; idx < Arguments.size(); idx++)
+    if (!dynamic_cast<IdentifierExprAST *>(Arguments[idx]) && context.arrayElementType(args[idx]->getType()))
+      context.createArrayRelease(args[idx]);
+  return call;
+}
+
+/* generates the argument values converted to the parameter types of fnType */
+bool CallExprAST::createArgumentsIR(Codegen &context, FunctionType *fnType,
+  std::vector<Value *> &args, bool needPrintIR)
+{
   int idx = 0;
   ExpressionList::const_iterator it;
   bool isVariadic = fnType->isVarArg();
@@ -370,15 +530,14 @@ Value *CallExprAST::createIR(Codegen &context, bool needPrintIR)
     {
       if (!context.isTypeConversionPossible(argType, expectedType)) {
         std::cout << "[AST] incompatible argument type " << idx << " for function" << Name.get() << std::endl;
-        return nullptr;
+        return false;
       }
       else
         val = context.createTypeCast(context.Builder, val, expectedType);
     }
     args.push_back(val);
   }
-  CallInst *call = context.Builder->CreateCall(function, args, Name.get());
-  return call;
+  return true;
 }
 
 Value *ReturnStatementAST::createIR(Codegen &context, bool needPrintIR)
@@ -395,7 +554,30 @@ Value *ReturnStatementAST::createIR(Codegen &context, bool needPrintIR)
   llvm::Type *expectedType = fnType->getReturnType();
   std::string fnName = std::string(function->getName());
 
-  Value *RetVal = Expr->createIR(context, needPrintIR);
+  // a self call in tail position becomes a jump back to the function start
+  CallExprAST *call = dynamic_cast<CallExprAST *>(Expr);
+  CodegenBlock *TheBlock = context.GeneratingBlocks.top();
+  if (call && call->Name.get() == fnName && TheBlock->tailRecurseBlock)
+  {
+    std::vector<Value *> args;
+    if (!call->createArgumentsIR(context, fnType, args, needPrintIR))
+      return nullptr;
+    // the array arguments are retained before any is stored: f(b, a) swaps them
+    for (unsigned idx = 0; idx < args.size(); idx++)
+      if (dynamic_cast<IdentifierExprAST *>(call->Arguments[idx]) && context.arrayElementType(args[idx]->getType()))
+        context.createArrayRetain(args[idx]);
+    for (unsigned idx = 0; idx < args.size(); idx++)
+      if (context.arrayElementType(args[idx]->getType()))
+        context.createArrayStore(args[idx], TheBlock->arguments[idx]);
+      else
+        context.Builder->CreateStore(args[idx], TheBlock->arguments[idx]);
+    context.Builder->CreateBr(TheBlock->tailRecurseBlock);
+    return nullptr;
+  }
+
+  Value *RetVal = context.arrayElementType(expectedType)
+    ? createOwnedArrayIR(context, *Expr, needPrintIR)
+    : Expr->createIR(context, needPrintIR);
   if (!RetVal)
   {
     std::cerr << "[AST] Failed to generate return result " << fnName << std::endl;
@@ -413,6 +595,17 @@ Value *ReturnStatementAST::createIR(Codegen &context, bool needPrintIR)
     }
     RetVal = context.createTypeCast(context.Builder, RetVal, expectedType);
   }
+  else if (CallInst *callInst = dyn_cast<CallInst>(RetVal))
+  {
+    // the language has no pointers to locals, so a returned call may reuse the
+    // frame; with the same prototype the arguments fit in it, and musttail
+    // makes deep tail recursion safe without -O (see Codegen::functionReturns).
+    // Releasing the arrays of its arguments after it keeps it a plain tail call.
+    Function *callee = callInst->getCalledFunction();
+    bool samePrototype = callee && callee->getFunctionType() == fnType && !fnType->isVarArg() &&
+      !callInst->getNextNode();
+    callInst->setTailCallKind(samePrototype ? CallInst::TCK_MustTail : CallInst::TCK_Tail);
+  }
   context.Builder->CreateRet(RetVal);
   return RetVal;
 }
@@ -430,21 +623,26 @@ Value *IfStatementAST::createIR(Codegen &context, bool needPrintIR)
   BasicBlock *ElseBB = BasicBlock::Create(*context.TheContext, "else");
   BasicBlock *MergeBB = BasicBlock::Create(*context.TheContext, "ifcont");
 
-  context.Builder->CreateCondBr(condVal, ThenBB, ElseBB);
+  BranchInst *branch = context.Builder->CreateCondBr(condVal, ThenBB, ElseBB);
   // then-block
   context.Builder->SetInsertPoint(ThenBB);
+  unsigned thenCounter = context.emitProfileCounter();
   if (ThenBlock)
     ThenBlock->createIR(context, needPrintIR);
-  // finish then-block
-  context.Builder->CreateBr(MergeBB);
+  // finish then-block unless it returned
+  if (!context.Builder->GetInsertBlock()->getTerminator())
+    context.Builder->CreateBr(MergeBB);
 
   // codegen for else-block:
   TheFunction->insert(TheFunction->end(), ElseBB);
   context.Builder->SetInsertPoint(ElseBB);
+  unsigned elseCounter = context.emitProfileCounter();
+  context.setBranchWeights(branch, thenCounter, elseCounter);
   if (ElseBlock)
     ElseBlock->createIR(context, needPrintIR);
-  // finish else-block
-  context.Builder->CreateBr(MergeBB);
+  // finish else-block unless it returned
+  if (!context.Builder->GetInsertBlock()->getTerminator())
+    context.Builder->CreateBr(MergeBB);
 
   TheFunction->insert(TheFunction->end(), MergeBB);
   context.Builder->SetInsertPoint(MergeBB);
@@ -476,44 +674,229 @@ Value *ForStatementAST::createIR(Codegen &context, bool needPrintIR)
   // FIXME: support an empty condition and generate the true value
   Value *condVal = Expr->createIR(context, needPrintIR);
   condVal = context.createNonZeroCmp(context.Builder, condVal);
-  context.Builder->CreateCondBr(condVal, BodyBB, ExitBB);
+  BranchInst *branch = context.Builder->CreateCondBr(condVal, BodyBB, ExitBB);
 
   TheFunction->insert(TheFunction->end(), BodyBB);
   context.Builder->SetInsertPoint(BodyBB);
+  unsigned bodyCounter = context.emitProfileCounter();
   if (Block)
     Block->createIR(context, needPrintIR);
 
-  for (it = After.begin(); it != After.end(); it++)
+  // the body may end with a return
+  if (!context.Builder->GetInsertBlock()->getTerminator())
   {
-    (**it).createIR(context, needPrintIR);
+    for (it = After.begin(); it != After.end(); it++)
+    {
+      (**it).createIR(context, needPrintIR);
+    }
+    context.Builder->CreateBr(LoopBB);
   }
-  context.Builder->CreateBr(LoopBB);
 
   TheFunction->insert(TheFunction->end(), ExitBB);
   context.Builder->SetInsertPoint(ExitBB);
+  unsigned exitCounter = context.emitProfileCounter();
+  context.setBranchWeights(branch, bodyCounter, exitCounter);
 
   return condVal;
 }
 
-/* typeOf methods */
-llvm::Type *NodeAST::typeOf(Codegen &context)
+/* the operators and identities of parallel for reductions */
+static Value *createReductionIR(IRBuilder<> &B, ReductionOp op, Value *L, Value *R)
+{
+  bool isDouble = L->getType()->isDoubleTy();
+  switch (op)
+  {
+  case ReductionOp::Sum:
+    return isDouble ? B.CreateFAdd(L, R, "sum") : B.CreateAdd(L, R, "sum");
+  case ReductionOp::Min:
+    return B.CreateBinaryIntrinsic(isDouble ? Intrinsic::minnum : Intrinsic::smin, L, R, nullptr, "min");
+  case ReductionOp::Max:
+    return B.CreateBinaryIntrinsic(isDouble ? Intrinsic::maxnum : Intrinsic::smax, L, R, nullptr, "max");
+  }
+  return nullptr;
+}
+
+static Constant *reductionIdentity(ReductionOp op, llvm::Type *type)
+{
+  if (type->isDoubleTy())
+    return op == ReductionOp::Sum ? ConstantFP::get(type, 0.0)
+      : ConstantFP::getInfinity(type, op == ReductionOp::Max);
+  return ConstantInt::get(type, op == ReductionOp::Sum ? 0
+    : op == ReductionOp::Min ? INT32_MAX : INT32_MIN, true);
+}
+
+/* Runs the loop on the thread pool: the parent copies its variables into an
+   environment struct and the identities of the reductions into a struct of
+   partial results, __parallel_for calls the outlined body on chunks of
+   [start, end) and merges the partial results of the workers into it. */
+Value *ParallelForStatementAST::createIR(Codegen &context, bool needPrintIR)
 {
-  std::cout << "Default typeOf called! Possible mistake. Type of the expression="
+  logCodegen("parallel for");
+  IRBuilder<> &B = *context.Builder;
+  LLVMContext &C = *context.TheContext;
+  llvm::Type *intType = Type::getInt32Ty(C);
+  llvm::Type *ptrType = PointerType::getUnqual(C);
+  CodegenBlock *Parent = context.GeneratingBlocks.top();
+
+  // the bounds are evaluated once, before the loop
+  Value *start = Start->createIR(context, needPrintIR);
+  Value *end = Bound->createIR(context, needPrintIR);
+  if (!start || !end)
+  {
+    std::cerr << "[AST] Empty codegen for the bounds of a parallel for" << std::endl;
+    return nullptr;
+  }
+  if (IsBoundInclusive)
+    end = B.CreateNSWAdd(end, B.getInt32(1), "end");
+
+  std::vector<std::pair<SymbolID, AllocaInst *>> captured(Parent->locals.begin(), Parent->locals.end());
+  llvm::sort(captured, [](auto &a, auto &b) { return a.first < b.first; });
+  std::vector<llvm::Type *> capturedTypes, reductionTypes;
+  for (auto &it : captured)
+    capturedTypes.push_back(it.second->getAllocatedType());
+  for (const Reduction &reduction : Reductions)
+    reductionTypes.push_back(reduction.Name->typeOf(context));
+  StructType *envType = StructType::get(C, capturedTypes);
+  StructType *slotType = StructType::get(C, reductionTypes);
+
+  Function *TheFunction = context.currentFunction();
+  Function *Body = Function::Create(
+      FunctionType::get(Type::getVoidTy(C), {intType, intType, ptrType, ptrType}, false),
+      GlobalValue::InternalLinkage, TheFunction->getName() + ".parallel", context.TheModule.get());
+  context.setTargetAttributes(Body);
+  Function *Merge = nullptr;
+  {
+    IRBuilderBase::InsertPointGuard guard(B);
+    context.pushFunction(Body);
+    BasicBlock *entry = BasicBlock::Create(C, "entry", Body);
+    B.SetInsertPoint(entry);
+    context.pushBlock(entry);
+    CodegenBlock *TheBlock = context.GeneratingBlocks.top();
+
+    Argument *begin = Body->getArg(0), *chunkEnd = Body->getArg(1);
+    Argument *env = Body->getArg(2), *slot = Body->getArg(3);
+    begin->setName("begin");
+    chunkEnd->setName("end");
+    env->setName("env");
+    slot->setName("partial");
+    for (unsigned k = 0; k < captured.size(); k++)
+    {
+      AllocaInst *copy = context.createBlockAlloca(entry, capturedTypes[k], captured[k].second->getName().str());
+      B.CreateStore(B.CreateLoad(capturedTypes[k], B.CreateStructGEP(envType, env, k)), copy);
+      TheBlock->locals[captured[k].first] = copy;
+    }
+    // the index and the reductions are private even if they are REPL globals
+    auto privateVariable = [&](IdentifierExprAST *name) {
+      AllocaInst *&alloca = TheBlock->locals[name->id(context)];
+      if (!alloca)
+        alloca = context.createBlockAlloca(entry, name->typeOf(context), std::string(name->Name));
+      return alloca;
+    };
+    std::vector<AllocaInst *> partials;
+    for (unsigned r = 0; r < Reductions.size(); r++)
+    {
+      partials.push_back(privateVariable(Reductions[r].Name));
+      B.CreateStore(B.CreateLoad(reductionTypes[r], B.CreateStructGEP(slotType, slot, r)), partials[r]);
+    }
+    AllocaInst *index = privateVariable(Index);
+    B.CreateStore(begin, index);
+    context.HasParallelLoops = true;
+    context.beginFunctionProfile(Body);
+
+    BasicBlock *LoopBB = BasicBlock::Create(C, "loop", Body);
+    BasicBlock *BodyBB = BasicBlock::Create(C, "blockLoop", Body);
+    BasicBlock *ExitBB = BasicBlock::Create(C, "afterLoop", Body);
+    B.CreateBr(LoopBB);
+    B.SetInsertPoint(LoopBB);
+    Value *condVal = B.CreateICmpSLT(B.CreateLoad(intType, index, Index->Name), chunkEnd, "inchunk");
+    BranchInst *branch = B.CreateCondBr(condVal, BodyBB, ExitBB);
+
+    B.SetInsertPoint(BodyBB);
+    unsigned bodyCounter = context.emitProfileCounter();
+    if (Block)
+      Block->createIR(context, needPrintIR);
+    Value *next = B.CreateNSWAdd(B.CreateLoad(intType, index, Index->Name), B.getInt32(1), "next");
+    B.CreateStore(next, index);
+    B.CreateBr(LoopBB);
+
+    B.SetInsertPoint(ExitBB);
+    unsigned exitCounter = context.emitProfileCounter();
+    context.setBranchWeights(branch, bodyCounter, exitCounter);
+    for (unsigned r = 0; r < Reductions.size(); r++)
+      B.CreateStore(B.CreateLoad(reductionTypes[r], partials[r]), B.CreateStructGEP(slotType, slot, r));
+    B.CreateRetVoid();
+    context.releaseArrayVariables(Body);
+    context.endFunctionProfile();
+    verifyFunction(*Body);
+    context.popBlock();
+    context.popFunction();
+
+    if (!Reductions.empty())
+    {
+      Merge = Function::Create(
+          FunctionType::get(Type::getVoidTy(C), {ptrType, ptrType}, false),
+          GlobalValue::InternalLinkage, Body->getName() + ".merge", context.TheModule.get());
+      Argument *into = Merge->getArg(0), *from = Merge->getArg(1);
+      B.SetInsertPoint(BasicBlock::Create(C, "entry", Merge));
+      for (unsigned r = 0; r < Reductions.size(); r++)
+      {
+        Value *intoAddr = B.CreateStructGEP(slotType, into, r);
+        Value *L = B.CreateLoad(reductionTypes[r], intoAddr);
+        Value *R = B.CreateLoad(reductionTypes[r], B.CreateStructGEP(slotType, from, r));
+        B.CreateStore(createReductionIR(B, Reductions[r].Op, L, R), intoAddr);
+      }
+      B.CreateRetVoid();
+    }
+  }
+
+  AllocaInst *envAddr = context.createBlockAlloca(Parent->block, envType, "env");
+  for (unsigned k = 0; k < captured.size(); k++)
+    B.CreateStore(B.CreateLoad(capturedTypes[k], captured[k].second), B.CreateStructGEP(envType, envAddr, k));
+  AllocaInst *slotAddr = context.createBlockAlloca(Parent->block, slotType, "reductions");
+  for (unsigned r = 0; r < Reductions.size(); r++)
+    B.CreateStore(reductionIdentity(Reductions[r].Op, reductionTypes[r]), B.CreateStructGEP(slotType, slotAddr, r));
+
+  B.CreateCall(context.TheModule->getFunction("__parallel_for"),
+    {Body, Merge ? (Value *)Merge : ConstantPointerNull::get(PointerType::getUnqual(C)),
+     start, end, envAddr, slotAddr, ConstantExpr::getSizeOf(slotType)});
+
+  // the variables of the enclosing function after the loop
+  auto parentAddress = [&](IdentifierExprAST *name) -> Value * {
+    if (AllocaInst *alloca = Parent->locals.lookup(name->id(context)))
+      return alloca;
+    return context.findGlobal(name->id(context));
+  };
+  for (unsigned r = 0; r < Reductions.size(); r++)
+  {
+    Value *address = parentAddress(Reductions[r].Name);
+    Value *L = B.CreateLoad(reductionTypes[r], address, Reductions[r].Name->Name);
+    Value *R = B.CreateLoad(reductionTypes[r], B.CreateStructGEP(slotType, slotAddr, r));
+    B.CreateStore(createReductionIR(B, Reductions[r].Op, L, R), address);
+  }
+  // the index ends where a sequential loop would leave it
+  B.CreateStore(B.CreateBinaryIntrinsic(Intrinsic::smax, start, end), parentAddress(Index));
+  return nullptr;
+}
+
+/* inferType methods, called once per node through typeOf */
+llvm::Type *NodeAST::inferType(Codegen &context)
+{
+  std::cout << "Default inferType called! Possible mistake. Type of the expression="
     << typeid(this).name() << std::endl;
   return Type::getVoidTy(*context.TheContext);
 }
 
-llvm::Type *IntExprAST::typeOf(Codegen &context)
+llvm::Type *IntExprAST::inferType(Codegen &context)
 {
   return Type::getInt32Ty(*context.TheContext);
 }
 
-llvm::Type *DoubleExprAST::typeOf(Codegen &context)
+llvm::Type *DoubleExprAST::inferType(Codegen &context)
 {
   return Type::getDoubleTy(*context.TheContext);
 }
 
-llvm::Type *StringExprAST::typeOf(Codegen &context)
+llvm::Type *StringExprAST::inferType(Codegen &context)
 {
   return PointerType::getUnqual(Type::getInt8Ty(*context.TheContext));
 }
@@ -526,25 +909,20 @@ bool ExprAST::isString(Codegen &context, llvm::Type *type) {
   return type == PointerType::getUnqual(Type::getInt8Ty(*context.TheContext));
 }
 
-llvm::Type *IdentifierExprAST::typeOf(Codegen &context)
+llvm::Type *IdentifierExprAST::inferType(Codegen &context)
 {
-  std::vector<NameTable *>::const_iterator it;
-  llvm::Type *type = nullptr;
-  for (it = context.NameTypesByBlock.begin(); it != context.NameTypesByBlock.end(); it++)
-  {
-    type = (**it)[Name];
-    if (type)
-      return type;
-  }
-  std::cerr << "[AST] typeOf: unknown variable " << Name << std::endl;
+  // the innermost declaration shadows the outer ones
+  llvm::Type *type = context.NameTypes.lookup(id(context));
+  if (!type)
+    std::cerr << "[AST] typeOf: unknown variable " << Name << std::endl;
   return type;
 }
 
-llvm::Type *BinaryExprAST::typeOf(Codegen &context)
+llvm::Type *BinaryExprAST::inferType(Codegen &context)
 {
   if (!typeCheck(context))
   {
-    std::cerr << "[AST] Failed type check in expession " << Op << std::endl;
+    std::cerr << "[AST] Failed type check in expession " << operatorName(Op) << std::endl;
     return Type::getVoidTy(*context.TheContext);
   }
   llvm::Type *LType = LHS->typeOf(context);
@@ -552,29 +930,51 @@ llvm::Type *BinaryExprAST::typeOf(Codegen &context)
   return (LType == RType) ? LType : Type::getDoubleTy(*context.TheContext);
 }
 
-llvm::Type *UnaryExprAST::typeOf(Codegen &context)
+llvm::Type *UnaryExprAST::inferType(Codegen &context)
 {
   if (!typeCheck(context))
   {
-    std::cerr << "[AST] Failed type check in expession " << Op << std::endl;
+    std::cerr << "[AST] Failed type check in expession " << operatorName(Op) << std::endl;
     return Type::getVoidTy(*context.TheContext);
   }
   return Expr->typeOf(context);
 }
 
-llvm::Type *ExpressionStatementAST::typeOf(Codegen &context)
+llvm::Type *IndexExprAST::inferType(Codegen &context)
+{
+  llvm::Type *elementType = context.arrayElementType(Name.typeOf(context));
+  if (!elementType)
+  {
+    std::cerr << "[AST] " << Name.Name << " is not an array" << std::endl;
+    return Type::getVoidTy(*context.TheContext);
+  }
+  return elementType;
+}
+
+llvm::Type *IndexAssignmentAST::inferType(Codegen &context)
+{
+  return LHS.typeOf(context);
+}
+
+/* the length, and the new length after an append */
+llvm::Type *MemberExprAST::inferType(Codegen &context)
+{
+  return Type::getInt32Ty(*context.TheContext);
+}
+
+llvm::Type *ExpressionStatementAST::inferType(Codegen &context)
 {
   return Statement.typeOf(context);
 }
 
-llvm::Type *CallExprAST::typeOf(Codegen &context)
+llvm::Type *CallExprAST::inferType(Codegen &context)
 {
-  std::string name = Name.get();
-  FunctionDeclarationAST *function = (*context.DefinedFunctions)[name];
+  std::string_view name = Name.get();
+  FunctionDeclarationAST *function = context.findFunction(name);
   if (function)
-    return context.stringTypeToLLVM(function->TypeName.get());
+    return context.stringTypeToLLVM(function->TypeName);
 
-  Function *externalFn = context.TheModule->getFunction(name.c_str());
+  Function *externalFn = context.findCallee(name);
   if (externalFn)
     return externalFn->getReturnType();
 
@@ -582,16 +982,15 @@ llvm::Type *CallExprAST::typeOf(Codegen &context)
   return nullptr;
 }
 
-llvm::Type *FunctionBlockAST::typeOf(Codegen &context)
+llvm::Type *FunctionBlockAST::inferType(Codegen &context)
 {
   return ReturnStmt.typeOf(context);
 }
 
-llvm::Type *ReturnStatementAST::typeOf(Codegen &context)
+llvm::Type *ReturnStatementAST::inferType(Codegen &context)
 {
   if (!Expr)
     return Type::getVoidTy(*context.TheContext);
-  llvm::Type *t = Expr->typeOf(context);
   return Expr->typeOf(context);
 }
 
@@ -620,30 +1019,211 @@ bool BinaryExprAST::typeCheck(Codegen &context)
 {
   llvm::Type *L = LHS->typeOf(context);
   llvm::Type *R = RHS->typeOf(context);
-  bool result = L == R || context.isTypeConversionPossible(L, R);
-  logTypecheck("expression " + Op, result);
+  bool result = (L == R || context.isTypeConversionPossible(L, R)) && !context.arrayElementType(L);
+  logTypecheck(std::string("expression ") + operatorName(Op), result);
   return result;
 }
 
 bool UnaryExprAST::typeCheck(Codegen &context)
 {
   llvm::Type *ExprType = Expr->typeOf(context);
-  return (Op.compare("-") == 0) && isNumeric(context, ExprType);
+  return Op == UnaryOp::Neg && isNumeric(context, ExprType);
+}
+
+bool ExpressionStatementAST::typeCheck(Codegen &context)
+{
+  return Statement.typeCheck(context);
+}
+
+/* the chunks of a parallel for loop have nowhere to return to */
+bool ReturnStatementAST::typeCheck(Codegen &context)
+{
+  if (context.ParallelLoopDepth)
+  {
+    std::cerr << "[AST] Return inside a parallel for loop" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool IfStatementAST::typeCheck(Codegen &context)
+{
+  bool result = Expr->typeCheck(context)
+    && (!ThenBlock || ThenBlock->typeCheck(context))
+    && (!ElseBlock || ElseBlock->typeCheck(context));
+  logTypecheck("if", result);
+  return result;
+}
+
+bool ForStatementAST::typeCheck(Codegen &context)
+{
+  bool result = true;
+  ExpressionList::const_iterator it;
+  for (it = Before.begin(); result && it != Before.end(); it++)
+    result = (**it).typeCheck(context);
+  result = result && Expr->typeCheck(context) && (!Block || Block->typeCheck(context));
+  for (it = After.begin(); result && it != After.end(); it++)
+    result = (**it).typeCheck(context);
+  logTypecheck("for", result);
+  return result;
+}
+
+/* i = start; i < bound or i <= bound; i = i + 1 */
+bool ParallelForStatementAST::matchCanonicalForm()
+{
+  if (Before.size() != 1 || After.size() != 1)
+    return false;
+  AssignmentAST *init = dynamic_cast<AssignmentAST *>(Before[0]);
+  BinaryExprAST *cond = dynamic_cast<BinaryExprAST *>(Expr);
+  AssignmentAST *step = dynamic_cast<AssignmentAST *>(After[0]);
+  if (!init || !cond || !step)
+    return false;
+
+  IdentifierExprAST *condIndex = dynamic_cast<IdentifierExprAST *>(cond->getLHS());
+  BinaryExprAST *increment = dynamic_cast<BinaryExprAST *>(&step->RHS);
+  if (!condIndex || !increment || increment->getOp() != BinaryOp::Add
+      || (cond->getOp() != BinaryOp::Lt && cond->getOp() != BinaryOp::Le))
+    return false;
+  IdentifierExprAST *stepIndex = dynamic_cast<IdentifierExprAST *>(increment->getLHS());
+  IntExprAST *one = dynamic_cast<IntExprAST *>(increment->getRHS());
+  std::string_view name = init->LHS.Name;
+  if (condIndex->Name != name || step->LHS.Name != name || !stepIndex || stepIndex->Name != name
+      || !one || one->getValue() != 1)
+    return false;
+
+  Index = &init->LHS;
+  Start = &init->RHS;
+  Bound = cond->getRHS();
+  IsBoundInclusive = cond->getOp() == BinaryOp::Le;
+  return true;
+}
+
+bool ParallelForStatementAST::typeCheck(Codegen &context)
+{
+  if (!matchCanonicalForm())
+  {
+    std::cerr << "[AST] A parallel for loop is written (i = start; i < end; i = i + 1)" << std::endl;
+    return false;
+  }
+  llvm::Type *intType = Type::getInt32Ty(*context.TheContext);
+  llvm::Type *doubleType = Type::getDoubleTy(*context.TheContext);
+  bool result = Start->typeCheck(context) && Bound->typeCheck(context);
+  if (result && (Index->typeOf(context) != intType || Start->typeOf(context) != intType
+      || Bound->typeOf(context) != intType))
+  {
+    std::cerr << "[AST] The index and the bounds of a parallel for loop are not int" << std::endl;
+    result = false;
+  }
+  for (const Reduction &reduction : Reductions)
+  {
+    llvm::Type *type = reduction.Name->typeOf(context);
+    if ((type != intType && type != doubleType) || reduction.Name->Name == Index->Name)
+    {
+      std::cerr << "[AST] Can not reduce " << reduction.Name->Name
+        << ", reductions are int or double variables other than the index" << std::endl;
+      result = false;
+    }
+  }
+
+  context.HasParallelLoops = true;
+  context.ParallelPrivates.emplace_back();
+  for (const Reduction &reduction : Reductions)
+    context.ParallelPrivates.back().insert(reduction.Name->id(context));
+  context.ParallelLoopDepth++;
+  result = result && (!Block || Block->typeCheck(context));
+  context.ParallelLoopDepth--;
+  context.ParallelPrivates.pop_back();
+  logTypecheck("parallel for", result);
+  return result;
+}
+
+/* Every chunk of a parallel for loop works on copies of the variables around
+   it, so the body may only assign its reductions and its own variables;
+   arrays are shared, their elements may be assigned but not appended to. */
+static bool isPrivateInParallelLoop(Codegen &context, IdentifierExprAST &name)
+{
+  return !context.ParallelLoopDepth || context.ParallelPrivates.back().count(name.id(context));
 }
 
 bool AssignmentAST::typeCheck(Codegen &context)
 {
+  if (!isPrivateInParallelLoop(context, LHS))
+  {
+    std::cerr << "[AST] Can not assign " << LHS.Name << " in a parallel for loop, "
+      << "it is not declared in the loop or reduced by it" << std::endl;
+    return false;
+  }
   llvm::Type *L = LHS.typeOf(context);
   llvm::Type *R = RHS.typeOf(context);
   bool result = L == R || context.isTypeConversionPossible(L, R);
-  logTypecheck("assignment " + LHS.Name, result);
+  logTypecheck("assignment " + std::string(LHS.Name), result);
+  return result;
+}
+
+bool IndexExprAST::typeCheck(Codegen &context)
+{
+  bool result = Index.typeCheck(context);
+  if (!context.arrayElementType(Name.typeOf(context)))
+  {
+    std::cerr << "[AST] " << Name.Name << " is not an array" << std::endl;
+    result = false;
+  }
+  else if (result && Index.typeOf(context) != Type::getInt32Ty(*context.TheContext))
+  {
+    std::cerr << "[AST] Index of " << Name.Name << " is not an int" << std::endl;
+    result = false;
+  }
+  logTypecheck("element of " + std::string(Name.Name), result);
+  return result;
+}
+
+bool IndexAssignmentAST::typeCheck(Codegen &context)
+{
+  bool result = LHS.typeCheck(context) && RHS.typeCheck(context);
+  if (result)
+  {
+    llvm::Type *L = LHS.typeOf(context);
+    llvm::Type *R = RHS.typeOf(context);
+    result = L == R || context.isTypeConversionPossible(R, L);
+  }
+  logTypecheck("assignment for element of " + std::string(LHS.Name.Name), result);
+  return result;
+}
+
+bool MemberExprAST::typeCheck(Codegen &context)
+{
+  llvm::Type *elementType = context.arrayElementType(Name.typeOf(context));
+  if (!elementType)
+  {
+    std::cerr << "[AST] " << Name.Name << " is not an array" << std::endl;
+    return false;
+  }
+  if (Member.Name == "length" && Arguments.empty())
+    return true;
+  if (Member.Name != "append" || Arguments.size() != 1)
+  {
+    std::cerr << "[AST] Arrays have length and append(value), not " << Member.Name << std::endl;
+    return false;
+  }
+
+  if (!isPrivateInParallelLoop(context, Name))
+  {
+    std::cerr << "[AST] Can not append to " << Name.Name << " in a parallel for loop, "
+      << "the chunks share it" << std::endl;
+    return false;
+  }
+  bool result = Arguments[0]->typeCheck(context);
+  llvm::Type *valueType = Arguments[0]->typeOf(context);
+  result = result && (valueType == elementType || context.isTypeConversionPossible(valueType, elementType));
+  logTypecheck("append to " + std::string(Name.Name), result);
   return result;
 }
 
 bool VarDeclExprAST::typeCheck(Codegen &context)
 {
-  NameTable *currentBlockTable = context.NameTypesByBlock.back();
-  (*currentBlockTable)[Name.get()] = context.stringTypeToLLVM(TypeName);
+  context.NameTypes.insert(Name.id(context), context.stringTypeToLLVM(TypeName));
+  if (context.ParallelLoopDepth)
+    context.ParallelPrivates.back().insert(Name.id(context));
 
   if (!AssignmentExpr)
     return true;
@@ -655,28 +1235,30 @@ bool VarDeclExprAST::typeCheck(Codegen &context)
   llvm::Type *R = AssignmentExpr->typeOf(context);
 
   bool result = L == R || context.isTypeConversionPossible(L, R);
-  logTypecheck("var decl " + Name.get(), result);
+  logTypecheck("var decl " + std::string(Name.get()), result);
   return result;
 }
 
 bool FunctionDeclarationAST::typeCheck(Codegen &context)
 {
-  NameTable *Names = new NameTable();
-  context.NameTypesByBlock.push_back(Names);
+  NameScope scope(context.NameTypes);
+  // a function declared in a parallel for loop returns normally
+  unsigned parallelLoopDepth = context.ParallelLoopDepth;
+  context.ParallelLoopDepth = 0;
 
   VariableList::const_iterator it;
   for (it = Arguments.begin(); it != Arguments.end(); it++)
   {
-    (*Names)[(**it).Name.get()] = context.stringTypeToLLVM((**it).TypeName);
+    context.NameTypes.insert((**it).Name.id(context), context.stringTypeToLLVM((**it).TypeName));
   }
 
   bool result = Block.typeCheck(context);
   llvm::Type *FNType = context.stringTypeToLLVM(TypeName);
   llvm::Type *Ret = Block.typeOf(context);
   result = result && (FNType == Ret || context.isTypeConversionPossible(FNType, Ret));
-  context.NameTypesByBlock.pop_back();
 
-  logTypecheck("function return type " + Name.get(), result);
+  context.ParallelLoopDepth = parallelLoopDepth;
+  logTypecheck("function return type " + std::string(Name.get()), result);
   return result;
 }
 
@@ -716,7 +1298,7 @@ bool CallExprAST::typeCheckExternalFn(Codegen &context, Function *function)
 
 bool CallExprAST::typeCheckUserFn(Codegen &context)
 {
-  FunctionDeclarationAST *fnDecl = (*context.DefinedFunctions)[Name.get()];
+  FunctionDeclarationAST *fnDecl = context.findFunction(Name.get());
   if (!fnDecl) {
     std::cerr << "[Typecheck on function call " << Name.get()
       << " failed: function not found" << std::endl;
@@ -747,10 +1329,10 @@ bool CallExprAST::typeCheckUserFn(Codegen &context)
 
 bool CallExprAST::typeCheck(Codegen &context)
 {
-  Function *function = context.TheModule->getFunction(Name.get().c_str());
+  Function *function = context.findCallee(Name.get());
   bool result = !function ? typeCheckUserFn(context)
     : typeCheckExternalFn(context, function);
 
-  logTypecheck("function call " + Name.get(), result);
+  logTypecheck("function call " + std::string(Name.get()), result);
   return result;
 }
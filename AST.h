@@ -2,12 +2,32 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <string_view>
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Function.h"
 
 class Codegen;
 
+/* operators produced by the lexer */
+enum class BinaryOp : unsigned char { Add, Sub, Mul, Div, Eq, Ne, Gt, Ge, Lt, Le };
+enum class UnaryOp : unsigned char { Neg };
+const char *operatorName(BinaryOp op);
+const char *operatorName(UnaryOp op);
+
+/* a token as a view into the source buffer; trivial to fit the parser's union */
+struct TokenText
+{
+  const char *Data;
+  size_t Length;
+  std::string_view view() const { return std::string_view(Data, Length); }
+};
+
+/* identifier names are interned to small integers, see Codegen::Symbols */
+typedef unsigned SymbolID;
+
 class NodeAST
 {
 public:
@@ -22,7 +42,20 @@ public:
     std::cout << "Default codegen: " << this << "\n";
     return nullptr;
   }
-  virtual llvm::Type *typeOf(Codegen &context);
+
+  /* the type is inferred once and stored on the node */
+  llvm::Type *typeOf(Codegen &context)
+  {
+    if (!AnnotatedType)
+      AnnotatedType = inferType(context);
+    return AnnotatedType;
+  }
+
+protected:
+  virtual llvm::Type *inferType(Codegen &context);
+
+private:
+  llvm::Type *AnnotatedType = nullptr;
 };
 
 class ExprAST : public NodeAST
@@ -47,7 +80,40 @@ class ReturnStatementAST;
 typedef std::vector<StatementAST *> StatementList;
 typedef std::vector<ExprAST *> ExpressionList;
 typedef std::vector<VarDeclExprAST *> VariableList;
-typedef std::map<std::string, FunctionDeclarationAST *> FunctionMap;
+typedef std::map<std::string, FunctionDeclarationAST *, std::less<>> FunctionMap;
+
+/* Owns the AST nodes and identifier names of one compilation.
+   Nodes are bump allocated and destroyed together with the arena. */
+class ASTArena
+{
+  llvm::BumpPtrAllocator Allocator;
+  llvm::UniqueStringSaver Strings;
+  std::vector<NodeAST *> Nodes;
+
+public:
+  ASTArena() : Strings(Allocator) {}
+  ASTArena(const ASTArena &) = delete;
+  ASTArena &operator=(const ASTArena &) = delete;
+  ~ASTArena()
+  {
+    for (auto it = Nodes.rbegin(); it != Nodes.rend(); it++)
+      (*it)->~NodeAST();
+  }
+
+  template <class T, class... Args>
+  T *create(Args &&...args)
+  {
+    T *node = new (Allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    Nodes.push_back(node);
+    return node;
+  }
+
+  /* number of nodes, reported by -stats */
+  size_t size() const { return Nodes.size(); }
+
+  /* one copy of every distinct name */
+  std::string_view save(std::string_view str) { return Strings.save(llvm::StringRef(str)); }
+};
 
 class BlockExprAST : public ExprAST
 {
@@ -78,7 +144,7 @@ public:
   FunctionBlockAST(ReturnStatementAST &ReturnStmt) : ReturnStmt(ReturnStmt) { Block = nullptr; }
 
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
   bool typeCheck(Codegen &context) override;
 };
 
@@ -88,13 +154,14 @@ class IntExprAST : public ExprAST
 
 public:
   IntExprAST(int Val) : Val(Val) {}
+  int getValue() const { return Val; }
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
 
   void pp() override
   {
     std::cout << "int= " << Val << std::endl;
   }
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 };
 
 class DoubleExprAST : public ExprAST
@@ -109,7 +176,7 @@ public:
   {
     std::cout << "double= " << Val << std::endl;
   }
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 };
 
 class StringExprAST : public ExprAST
@@ -119,7 +186,7 @@ class StringExprAST : public ExprAST
 public:
   StringExprAST(const std::string &Val) : Val(Val) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 
   void pp() override
   {
@@ -129,49 +196,56 @@ public:
 
 class IdentifierExprAST : public ExprAST
 {
+  static const SymbolID NoSymbol = ~0u;
+  SymbolID ID = NoSymbol;
+
 public:
-  std::string Name;
-  IdentifierExprAST(const std::string &Name) : Name(Name) {}
+  std::string_view Name; /* saved in the ASTArena or a string literal */
+  IdentifierExprAST(std::string_view Name) : Name(Name) {}
+  SymbolID id(Codegen &context);
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
 
   void pp() override
   {
     std::cout << "indentifier " << Name << std::endl;
   }
-  llvm::Type *typeOf(Codegen &context) override;
-  const std::string &get() const { return Name; };
+  llvm::Type *inferType(Codegen &context) override;
+  std::string_view get() const { return Name; };
 };
 
 class BinaryExprAST : public ExprAST
 {
-  std::string Op;
+  BinaryOp Op;
   ExprAST *LHS, *RHS;
 
 public:
-  BinaryExprAST(std::string Op, ExprAST *LHS, ExprAST *RHS)
+  BinaryExprAST(BinaryOp Op, ExprAST *LHS, ExprAST *RHS)
       : Op(Op), LHS(LHS), RHS(RHS) {}
+  BinaryOp getOp() const { return Op; }
+  ExprAST *getLHS() const { return LHS; }
+  ExprAST *getRHS() const { return RHS; }
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
   bool typeCheck(Codegen &context) override;
 
   void pp() override
   {
-    std::cout << "Expression " << Op << ":\n\tleft: ";
+    std::cout << "Expression " << operatorName(Op) << ":\n\tleft: ";
     LHS->pp();
     std::cout << "\tright: ";
     RHS->pp();
   }
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 };
 
 class UnaryExprAST : public ExprAST
 {
-  std::string Op;
+  UnaryOp Op;
   ExprAST *Expr;
 public:
-  UnaryExprAST(std::string Op, ExprAST *Expr) : Op(Op), Expr(Expr) {}
+  UnaryExprAST(UnaryOp Op, ExprAST *Expr) : Op(Op), Expr(Expr) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
   bool typeCheck(Codegen &context) override;
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 };
 
 class AssignmentAST : public ExprAST
@@ -190,6 +264,70 @@ public:
   }
 };
 
+/* a[i] */
+class IndexExprAST : public ExprAST
+{
+public:
+  IdentifierExprAST &Name;
+  ExprAST &Index;
+  IndexExprAST(IdentifierExprAST &Name, ExprAST &Index) : Name(Name), Index(Index) {}
+  llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  llvm::Value *createAddressIR(Codegen &context, bool needPrintIR = false);
+  bool typeCheck(Codegen &context) override;
+
+  void pp() override
+  {
+    std::cout << "Element of " << Name.Name << ":\n\tindex: ";
+    Index.pp();
+  }
+  llvm::Type *inferType(Codegen &context) override;
+};
+
+/* a[i] = value */
+class IndexAssignmentAST : public ExprAST
+{
+public:
+  IndexExprAST &LHS;
+  ExprAST &RHS;
+  IndexAssignmentAST(IndexExprAST &LHS, ExprAST &RHS) : LHS(LHS), RHS(RHS) {}
+  llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool typeCheck(Codegen &context) override;
+
+  void pp() override
+  {
+    std::cout << "Assignment: ";
+    LHS.pp();
+    std::cout << "\t= ";
+    RHS.pp();
+  }
+  llvm::Type *inferType(Codegen &context) override;
+};
+
+/* a.length and a.append(value) of arrays */
+class MemberExprAST : public ExprAST
+{
+public:
+  IdentifierExprAST &Name;
+  const IdentifierExprAST &Member;
+  ExpressionList Arguments;
+  MemberExprAST(IdentifierExprAST &Name, const IdentifierExprAST &Member) : Name(Name), Member(Member) {}
+  MemberExprAST(IdentifierExprAST &Name, const IdentifierExprAST &Member, ExpressionList &Arguments)
+    : Name(Name), Member(Member), Arguments(Arguments) {}
+  llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool typeCheck(Codegen &context) override;
+
+  void pp() override
+  {
+    std::cout << "Member " << Name.Name << "." << Member.Name << std::endl;
+    ExpressionList::const_iterator it;
+    for (it = Arguments.begin(); it != Arguments.end(); it++)
+    {
+      (**it).pp();
+    }
+  }
+  llvm::Type *inferType(Codegen &context) override;
+};
+
 class CallExprAST : public ExprAST
 {
 private:
@@ -202,6 +340,8 @@ public:
   CallExprAST(const IdentifierExprAST &Name, ExpressionList &Arguments) : Name(Name), Arguments(Arguments) {}
   CallExprAST(const IdentifierExprAST &Name) : Name(Name) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool createArgumentsIR(Codegen &context, llvm::FunctionType *fnType,
+                         std::vector<llvm::Value *> &args, bool needPrintIR = false);
   bool typeCheck(Codegen &context) override;
 
   void pp() override
@@ -213,7 +353,7 @@ public:
       (**it).pp();
     }
   }
-  llvm::Type *typeOf(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 };
 
 class ExpressionStatementAST : public StatementAST
@@ -222,7 +362,8 @@ public:
   ExprAST &Statement;
   ExpressionStatementAST(ExprAST &Statement) : Statement(Statement) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
-  llvm::Type *typeOf(Codegen &context) override;
+  bool typeCheck(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 
   void pp() override
   {
@@ -265,6 +406,7 @@ public:
   const IdentifierExprAST &Name;
   VariableList Arguments;
   FunctionBlockAST &Block;
+  bool IsTailRecursive = false; /* declared with tailrec */
   FunctionDeclarationAST(const IdentifierExprAST &TypeName,
                          const IdentifierExprAST &Name,
                          const VariableList &Arguments,
@@ -306,7 +448,8 @@ public:
   ReturnStatementAST() : Expr(nullptr) {}
   ReturnStatementAST(ExprAST *Expr) : Expr(Expr) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
-  llvm::Type *typeOf(Codegen &context) override;
+  bool typeCheck(Codegen &context) override;
+  llvm::Type *inferType(Codegen &context) override;
 
   void pp() override
   {
@@ -330,16 +473,12 @@ public:
   BlockExprAST *ThenBlock;
   BlockExprAST *ElseBlock;
 
-  IfStatementAST(ExprAST *Expr, BlockExprAST *ThenBlock) : Expr(Expr), ThenBlock(ThenBlock) {}
+  IfStatementAST(ExprAST *Expr, BlockExprAST *ThenBlock) : Expr(Expr), ThenBlock(ThenBlock), ElseBlock(nullptr) {}
   IfStatementAST(ExprAST *Expr, BlockExprAST *ThenBlock, BlockExprAST *ElseBlock) :
     Expr(Expr), ThenBlock(ThenBlock), ElseBlock(ElseBlock) {}
 
-  IfStatementAST(ExprAST *Expr, BlockExprAST *ThenBlock, StatementAST *Elif) :
-    Expr(Expr), ThenBlock(ThenBlock) {
-      ElseBlock = new BlockExprAST();
-      ElseBlock->Statements.push_back(Elif);
-    }
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool typeCheck(Codegen &context) override;
   // no return type
 
   void pp() override
@@ -366,6 +505,7 @@ class ForStatementAST : public StatementAST
   ForStatementAST(ExpressionList &Before, ExprAST *Expr, ExpressionList &After, BlockExprAST *Block)
     : Before(Before), Expr(Expr), After(After), Block(Block) {}
   llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool typeCheck(Codegen &context) override;
   // no return type
 
   void pp() override
@@ -392,4 +532,45 @@ class ForStatementAST : public StatementAST
       (**it).pp();
     }
   }
-};
\ No newline at end of file
+};
+
+/* reduction operators of parallel for loops */
+enum class ReductionOp : unsigned char { Sum, Min, Max };
+struct Reduction
+{
+  ReductionOp Op;
+  IdentifierExprAST *Name;
+};
+typedef std::vector<Reduction> ReductionList;
+
+/* parallel for (i = a; i < b; i = i + 1) reduce(+: s, min: m) { ... }
+   The body is outlined into a function that runs chunks of the iterations on
+   the thread pool of the runtime. The other variables are copied into every
+   chunk, so the body may not assign them or append to their arrays; the
+   reduction variables start from the identity of their operator in every
+   worker and the partial results are merged when the loop ends. */
+class ParallelForStatementAST : public ForStatementAST
+{
+  IdentifierExprAST *Index = nullptr;
+  ExprAST *Start = nullptr, *Bound = nullptr;
+  bool IsBoundInclusive = false;
+  bool matchCanonicalForm();
+
+public:
+  ReductionList Reductions;
+
+  ParallelForStatementAST(ExpressionList &Before, ExprAST *Expr, ExpressionList &After,
+                          const ReductionList &Reductions, BlockExprAST *Block)
+    : ForStatementAST(Before, Expr, After, Block), Reductions(Reductions) {}
+  llvm::Value *createIR(Codegen &context, bool needPrintIR = false) override;
+  bool typeCheck(Codegen &context) override;
+
+  void pp() override
+  {
+    std::cout << "Parallel for loop, reductions:";
+    for (const Reduction &reduction : Reductions)
+      std::cout << " " << reduction.Name->Name;
+    std::cout << std::endl;
+    ForStatementAST::pp();
+  }
+};
@@ -15,17 +15,23 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/Orc/Shared/ExecutorSymbolDef.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/TargetParser/SubtargetFeature.h"
 #include <memory>
 #include <iostream>
 
@@ -41,27 +47,51 @@ namespace llvm
 
       DataLayout DL;
       MangleAndInterner Mangle;
+      JITTargetMachineBuilder TMBuilder;
 
       RTDyldObjectLinkingLayer ObjectLayer;
       IRCompileLayer CompileLayer;
 
+      /* lazy modules: each function is optimized and compiled on its first
+         call, until then calls go through an indirection stub */
+      IRTransformLayer OptimizeLayer;
+      std::unique_ptr<LazyCallThroughManager> LCTMgr;
+      CompileOnDemandLayer CODLayer;
+
+      /* stable entry points of functions that can be redefined, see redirect */
+      std::unique_ptr<IndirectStubsManager> StubsMgr;
+
       JITDylib &MainJD;
 
+      static void handleLazyCallThroughError()
+      {
+        errs() << "LazyCallThrough error: Could not find function body";
+        exit(1);
+      }
+
     public:
       SimpleJIT(std::unique_ptr<ExecutionSession> ES,
-                JITTargetMachineBuilder JTMB, DataLayout DL)
+                std::unique_ptr<LazyCallThroughManager> LCTMgr,
+                JITTargetMachineBuilder JTMB, DataLayout DL,
+                ObjectCache *Cache = nullptr)
           : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+            TMBuilder(JTMB),
             ObjectLayer(*this->ES,
                         []()
                         { return std::make_unique<SectionMemoryManager>(); }),
             CompileLayer(*this->ES, ObjectLayer,
-                         std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
+                         std::make_unique<ConcurrentIRCompiler>(std::move(JTMB), Cache)),
+            OptimizeLayer(*this->ES, CompileLayer),
+            LCTMgr(std::move(LCTMgr)),
+            CODLayer(*this->ES, OptimizeLayer, *this->LCTMgr,
+                     createLocalIndirectStubsManagerBuilder(TMBuilder.getTargetTriple())),
+            StubsMgr(createLocalIndirectStubsManagerBuilder(TMBuilder.getTargetTriple())()),
             MainJD(this->ES->createBareJITDylib("<main>"))
       {
         MainJD.addGenerator(
             cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
                 DL.getGlobalPrefix())));
-        if (JTMB.getTargetTriple().isOSBinFormatCOFF())
+        if (TMBuilder.getTargetTriple().isOSBinFormatCOFF())
         {
           ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
           ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
@@ -74,9 +104,14 @@ namespace llvm
           ES->reportError(std::move(Err));
       }
 
-      static Expected<std::unique_ptr<SimpleJIT>> Create()
+      static Expected<std::unique_ptr<SimpleJIT>> Create(const std::string &CPU = "",
+                                                         const std::string &Features = "",
+                                                         ObjectCache *Cache = nullptr)
       {
-        auto EPC = SelfExecutorProcessControl::Create();
+        // materialization tasks run on a thread pool, so modules needed by a
+        // lookup are compiled concurrently
+        auto EPC = SelfExecutorProcessControl::Create(
+            nullptr, std::make_unique<DynamicThreadPoolTaskDispatcher>());
         if (!EPC)
           return EPC.takeError();
 
@@ -84,6 +119,10 @@ namespace llvm
 
         JITTargetMachineBuilder JTMB(
             ES->getExecutorProcessControl().getTargetTriple());
+        if (!CPU.empty())
+          JTMB.setCPU(CPU);
+        if (!Features.empty())
+          JTMB.addFeatures(SubtargetFeatures(Features).getFeatures());
 
         auto DL = JTMB.getDefaultDataLayoutForTarget();
         if (!DL)
@@ -92,14 +131,22 @@ namespace llvm
           return DL.takeError();
         }
 
-        return std::make_unique<SimpleJIT>(std::move(ES), std::move(JTMB),
-                                           std::move(*DL));
+        auto LCTMgr = createLocalLazyCallThroughManager(
+            JTMB.getTargetTriple(), *ES,
+            ExecutorAddr::fromPtr(&handleLazyCallThroughError));
+        if (!LCTMgr)
+          return LCTMgr.takeError();
+
+        return std::make_unique<SimpleJIT>(std::move(ES), std::move(*LCTMgr),
+                                           std::move(JTMB), std::move(*DL), Cache);
       }
 
       const DataLayout &getDataLayout() const { return DL; }
 
       JITDylib &getMainJITDylib() { return MainJD; }
 
+      JITTargetMachineBuilder getTargetMachineBuilder() const { return TMBuilder; }
+
       Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr)
       {
         if (!RT)
@@ -107,6 +154,32 @@ namespace llvm
         return CompileLayer.add(RT, std::move(TSM));
       }
 
+      /* the functions of the module are compiled when they are first called */
+      Error addLazyModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr)
+      {
+        if (!RT)
+          RT = MainJD.getDefaultResourceTracker();
+        return CODLayer.add(RT, std::move(TSM));
+      }
+
+      /* runs on every function of a lazy module before it is compiled */
+      void setLazyTransform(IRTransformLayer::TransformFunction Transform)
+      {
+        OptimizeLayer.setTransform(std::move(Transform));
+      }
+
+      /* Name resolves to a stub that jumps to Address; code calling Name
+         follows a later redirect, so the old definition can be removed */
+      Error redirect(StringRef Name, ExecutorAddr Address)
+      {
+        if (StubsMgr->findStub(Name, true).getAddress())
+          return StubsMgr->updatePointer(Name, Address);
+        if (auto Err = StubsMgr->createStub(Name, Address, JITSymbolFlags::Exported))
+          return Err;
+        return MainJD.define(
+            absoluteSymbols({{Mangle(Name.str()), StubsMgr->findStub(Name, true)}}));
+      }
+
       Expected<ExecutorSymbolDef> lookup(StringRef Name)
       {
         return ES->lookup({&MainJD}, Mangle(Name.str()));
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Runs the same kernels as a JIT program (-i), as an object file linked with
+runtime.cpp, as C++ at -O2 and as Python, and writes the timings to a JSON
+file. Python programs are compiled with Cython and compile_python.sh when
+cython is installed, otherwise they run in the interpreter.
+
+    python3 benchmark.py [--repeat N] [--warmup N] [--variants jit,aot,cpp,python]
+                         [--output bench.json] [kernel ...]
+"""
+import argparse
+import json
+import os
+import platform
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+BUILD = os.path.join(ROOT, "bench_build")
+
+# kernel name: (.t source, C++ source, Python source)
+KERNELS = {
+    "sinus": ("tests/sinus/sinus.t", "tests/sinus/sinus.cpp", "tests/sinus/sinus.py"),
+    "mandelbrot": ("tests/mandelbrot.t", "tests/mandelbrot/mandelbrot.cpp", "tests/mandelbrot/mandelbrot.py"),
+    "fib": ("tests/fib/fib.t", "tests/fib/fib.cpp", "tests/fib/fib.py"),
+    "leibniz": ("tests/leibniz/leibniz.t", "tests/leibniz/leibniz.cpp", "tests/leibniz/leibniz.py"),
+}
+VARIANTS = ["jit", "aot", "cpp", "python"]
+
+
+def timed(command):
+    """wall time of a command; its output is discarded"""
+    start = time.perf_counter()
+    result = subprocess.run(command, cwd=ROOT, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError("%s failed: %s" % (" ".join(command), result.stderr.decode(errors="replace").strip()))
+    return elapsed
+
+
+def build(kernel, variant):
+    """builds the kernel; returns the command that runs it and the compile time"""
+    source_t, source_cpp, source_py = KERNELS[kernel]
+    binary = os.path.join(BUILD, "%s_%s" % (kernel, variant))
+    if variant == "jit":
+        # compilation is part of every run
+        return ["./compiler", "-i", source_t], None
+    if variant == "aot":
+        obj = binary + ".o"
+        compile_time = timed(["./compiler", source_t, "-o", obj])
+        # the runtime is built like the C++ variant, the kernels call into it
+        timed(["clang++", "-O2", "-pthread", "runtime.cpp", obj, "-o", binary])
+        return [binary], compile_time
+    if variant == "cpp":
+        compile_time = timed(["clang++", "-O2", source_cpp, "-o", binary])
+        return [binary], compile_time
+    if shutil.which("cython"):
+        c_file = binary + ".c"
+        start = time.perf_counter()
+        timed(["cython", "--embed", "-3", source_py, "-o", c_file])
+        timed(["sh", "compile_python.sh", c_file, binary])
+        return [binary], time.perf_counter() - start
+    return [sys.executable, source_py], None
+
+
+def measure(command, repeat, warmup):
+    for _ in range(warmup):
+        timed(command)
+    runs = [timed(command) for _ in range(repeat)]
+    return {
+        "median_s": statistics.median(runs),
+        "min_s": min(runs),
+        "stddev_s": statistics.stdev(runs) if len(runs) > 1 else 0.0,
+        "runs_s": runs,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cross-language kernel benchmarks")
+    parser.add_argument("kernels", nargs="*", default=list(KERNELS), help="kernels to run")
+    parser.add_argument("--repeat", type=int, default=5, help="measured runs per variant")
+    parser.add_argument("--warmup", type=int, default=1, help="unmeasured runs before them")
+    parser.add_argument("--variants", default=",".join(VARIANTS), help="comma separated subset of " + ",".join(VARIANTS))
+    parser.add_argument("--output", default="bench.json", help="JSON file with the results")
+    args = parser.parse_args()
+
+    os.makedirs(BUILD, exist_ok=True)
+    variants = [v for v in args.variants.split(",") if v]
+    results = {}
+    for kernel in args.kernels:
+        results[kernel] = {}
+        for variant in variants:
+            try:
+                command, compile_time = build(kernel, variant)
+                result = measure(command, args.repeat, args.warmup)
+                result["compile_s"] = compile_time
+            except (RuntimeError, OSError) as error:
+                result = {"error": str(error)}
+            results[kernel][variant] = result
+            if "error" in result:
+                print("%-12s %-7s FAILED %s" % (kernel, variant, result["error"]))
+            else:
+                print("%-12s %-7s median %8.4f s  min %8.4f s  stddev %7.4f s  compile %s" % (
+                    kernel, variant, result["median_s"], result["min_s"], result["stddev_s"],
+                    "%.4f s" % compile_time if compile_time is not None else "-"))
+
+    # C++ -O2 is the reference the other variants are compared with
+    for kernel in results:
+        reference = results[kernel].get("cpp", {}).get("median_s")
+        for result in results[kernel].values():
+            if reference and "median_s" in result:
+                result["relative_to_cpp"] = result["median_s"] / reference
+
+    commit = subprocess.run(["git", "rev-parse", "HEAD"], cwd=ROOT, capture_output=True, text=True).stdout.strip()
+    report = {
+        "commit": commit,
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "repeat": args.repeat,
+        "warmup": args.warmup,
+        "kernels": results,
+    }
+    with open(os.path.join(ROOT, args.output), "w") as f:
+        json.dump(report, f, indent=2)
+    print("Wrote " + args.output)
+
+
+if __name__ == "__main__":
+    main()
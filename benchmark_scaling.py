@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Compiles synthetic programs of growing size (generate_source.py) to object
+files and records the time of each compile phase and the peak memory from
+-stats-json. The time per source line should stay flat if the compiler
+scales linearly; the last column of the table is that time relative to the
+smallest program. A plot is written when matplotlib is installed.
+
+    python3 benchmark_scaling.py [--sizes 100,200,...] [--statements N] [--depth N]
+                                 [--nesting N] [--repeat N] [--output scaling.json]
+                                 [--plot scaling.png] [compiler options ...]
+"""
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import time
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+BUILD = os.path.join(ROOT, "bench_build")
+
+# -ftime-report timer names of the compile phases, in order
+PHASES = ["parse", "typecheck", "codegen", "optimize", "emit"]
+
+
+def compile_once(source, options):
+    """wall time and the -stats-json of one compilation"""
+    stats_file = source + ".json"
+    command = ["./compiler", source, "-o", source + ".o", "-stats-json=" + stats_file] + options
+    start = time.perf_counter()
+    result = subprocess.run(command, cwd=ROOT, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    elapsed = time.perf_counter() - start
+    if result.returncode != 0:
+        raise RuntimeError("%s failed: %s" % (" ".join(command), result.stderr.decode(errors="replace").strip()))
+    with open(stats_file) as f:
+        return elapsed, json.load(f)
+
+
+def measure(source, options, repeat):
+    """the fastest of repeat compilations; peak memory does not vary"""
+    best = None
+    for _ in range(repeat):
+        elapsed, stats = compile_once(source, options)
+        if best is None or elapsed < best["total_s"]:
+            best = {"total_s": elapsed, "stats": stats}
+    stats = best["stats"]
+    result = {key: value for key, value in stats.items() if not key.startswith("time.")}
+    result["total_s"] = best["total_s"]
+    for phase in PHASES:
+        result[phase + "_s"] = stats.get("time.phases.%s.wall" % phase, 0.0)
+    return result
+
+
+def plot(results, filename):
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib is not installed, no plot written")
+        return
+    lines = [r["source_lines"] for r in results]
+    figure, (times, memory) = plt.subplots(1, 2, figsize=(12, 5))
+    bottom = [0.0] * len(results)
+    for phase in PHASES:
+        values = [r[phase + "_s"] for r in results]
+        times.fill_between(lines, bottom, [b + v for b, v in zip(bottom, values)], label=phase)
+        bottom = [b + v for b, v in zip(bottom, values)]
+    times.plot(lines, [r["total_s"] for r in results], "k.-", label="process")
+    times.set_xlabel("source lines")
+    times.set_ylabel("seconds")
+    times.legend(loc="upper left")
+    memory.plot(lines, [r["peak_rss_kb"] / 1024.0 for r in results], "o-")
+    memory.set_xlabel("source lines")
+    memory.set_ylabel("peak RSS, MB")
+    figure.tight_layout()
+    figure.savefig(os.path.join(ROOT, filename))
+    print("Wrote " + filename)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="compile time and memory against program size")
+    parser.add_argument("--sizes", default="100,200,500,1000,2000,5000", help="comma separated numbers of functions")
+    parser.add_argument("--statements", type=int, default=20, help="statements per function")
+    parser.add_argument("--depth", type=int, default=3, help="operators nested in an expression")
+    parser.add_argument("--nesting", type=int, default=2, help="if and for statements nested in each other")
+    parser.add_argument("--repeat", type=int, default=3, help="compilations per size, the fastest is kept")
+    parser.add_argument("--output", default="scaling.json", help="JSON file with the results")
+    parser.add_argument("--plot", default="scaling.png", help="plot of time and memory, if matplotlib is installed")
+    parser.add_argument("options", nargs=argparse.REMAINDER, help="compiler options, e.g. -O0")
+    args = parser.parse_args()
+
+    os.makedirs(BUILD, exist_ok=True)
+    results = []
+    print("%8s %8s %10s" % ("functions", "lines", "total") +
+          "".join("%10s" % phase for phase in PHASES) + "%10s %8s" % ("RSS MB", "us/line"))
+    for size in [int(s) for s in args.sizes.split(",") if s]:
+        source = os.path.join(BUILD, "scale_%d.t" % size)
+        subprocess.run([sys.executable, os.path.join(ROOT, "generate_source.py"),
+                        "--functions", str(size), "--statements", str(args.statements),
+                        "--depth", str(args.depth), "--nesting", str(args.nesting), "-o", source], check=True)
+        try:
+            result = measure(source, args.options, args.repeat)
+        except (RuntimeError, OSError) as error:
+            print("%8d FAILED %s" % (size, error))
+            continue
+        result["functions"] = size
+        result["us_per_line"] = result["total_s"] / max(1, result["source_lines"]) * 1e6
+        results.append(result)
+        print("%8d %8d %10.3f" % (size, result["source_lines"], result["total_s"]) +
+              "".join("%10.3f" % result[phase + "_s"] for phase in PHASES) +
+              "%10.1f %8.2f" % (result["peak_rss_kb"] / 1024.0, result["us_per_line"]))
+
+    if results:
+        # a growing ratio means a superlinear phase
+        for result in results:
+            result["us_per_line_relative"] = result["us_per_line"] / results[0]["us_per_line"]
+        print("time per line, relative to the smallest program: " +
+              " ".join("%.2f" % r["us_per_line_relative"] for r in results))
+        plot(results, args.plot)
+
+    commit = subprocess.run(["git", "rev-parse", "HEAD"], cwd=ROOT, capture_output=True, text=True).stdout.strip()
+    report = {
+        "commit": commit,
+        "date": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "statements": args.statements,
+        "depth": args.depth,
+        "nesting": args.nesting,
+        "options": args.options,
+        "sizes": results,
+    }
+    with open(os.path.join(ROOT, args.output), "w") as f:
+        json.dump(report, f, indent=2)
+    print("Wrote " + args.output)
+
+
+if __name__ == "__main__":
+    main()
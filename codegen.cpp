@@ -18,6 +18,15 @@ AllocaInst *Codegen::createBlockAlloca(BasicBlock *BB, llvm::Type *type, const s
   return TmpB.CreateAlloca(type, nullptr, VarName);
 }
 
+/* lets the vectorizers and the backend use the -mcpu/-mattr subtarget */
+void Codegen::setTargetAttributes(Function *F)
+{
+  if (!TargetCPU.empty())
+    F->addFnAttr("target-cpu", TargetCPU);
+  if (!TargetFeatures.empty())
+    F->addFnAttr("target-features", TargetFeatures);
+}
+
 Value *Codegen::createTypeCast(std::unique_ptr<IRBuilder<>> const &Builder,
   Value *value, llvm::Type *toType)
 {
@@ -47,10 +56,178 @@ Value *Codegen::createNonZeroCmp(std::unique_ptr<IRBuilder<>> const &Builder,
   return value;
 }
 
+/* TBAA tags keep the array headers and the elements apart, so loads of the
+   length and the buffer can be hoisted out of loops that store elements */
+MDNode *Codegen::arrayTBAA(StringRef name)
+{
+  MDBuilder MDB(*TheContext);
+  MDNode *scalar = MDB.createTBAAScalarTypeNode(name, MDB.createTBAARoot("array TBAA"));
+  return MDB.createTBAAStructTagNode(scalar, scalar, 0);
+}
+
+static const char *ArrayFieldNames[] = {
+  "array refcount", "array elemsize", "array length", "array capacity", "array buffer"
+};
+
+Value *Codegen::createArrayFieldLoad(Value *array, ArrayField field)
+{
+  llvm::Type *int32Type = Type::getInt32Ty(*TheContext);
+  llvm::Type *ptrType = PointerType::getUnqual(*TheContext);
+  StructType *headerType = StructType::get(*TheContext,
+    {int32Type, int32Type, int32Type, int32Type, ptrType});
+  Value *header = Builder->CreateExtractValue(array, 0, "header");
+  Value *address = Builder->CreateStructGEP(headerType, header, field);
+  LoadInst *load = Builder->CreateLoad(headerType->getElementType(field), address,
+    ArrayFieldNames[field]);
+  load->setMetadata(LLVMContext::MD_tbaa, arrayTBAA(ArrayFieldNames[field]));
+  return load;
+}
+
+void Codegen::createArrayFieldStore(Value *array, ArrayField field, Value *value)
+{
+  llvm::Type *int32Type = Type::getInt32Ty(*TheContext);
+  llvm::Type *ptrType = PointerType::getUnqual(*TheContext);
+  StructType *headerType = StructType::get(*TheContext,
+    {int32Type, int32Type, int32Type, int32Type, ptrType});
+  Value *header = Builder->CreateExtractValue(array, 0, "header");
+  Value *address = Builder->CreateStructGEP(headerType, header, field);
+  StoreInst *store = Builder->CreateStore(value, address);
+  store->setMetadata(LLVMContext::MD_tbaa, arrayTBAA(ArrayFieldNames[field]));
+}
+
+/* Address of an element, after a check of the index unless -fno-bounds-check.
+   The failing branch is cold and noreturn, so IRCE can take the checks out
+   of loops over the array and the loop vectorizer sees a plain loop. */
+Value *Codegen::createArrayElementAddress(Value *array, Value *index, llvm::Type *elementType)
+{
+  if (BoundsChecks)
+  {
+    Value *length = createArrayFieldLoad(array, ArrayLength);
+    Value *inBounds = Builder->CreateICmpULT(index, length, "inbounds");
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    BasicBlock *FailBB = BasicBlock::Create(*TheContext, "outofbounds", TheFunction);
+    BasicBlock *ContinueBB = BasicBlock::Create(*TheContext, "element", TheFunction);
+    BranchInst *branch = Builder->CreateCondBr(inBounds, ContinueBB, FailBB);
+    branch->setMetadata(LLVMContext::MD_prof, MDBuilder(*TheContext).createBranchWeights(1 << 20, 1));
+
+    Builder->SetInsertPoint(FailBB);
+    Builder->CreateCall(TheModule->getFunction("__array_bounds"), {index, length});
+    Builder->CreateUnreachable();
+    Builder->SetInsertPoint(ContinueBB);
+  }
+  Value *buf = createArrayFieldLoad(array, ArrayBuf);
+  Value *offset = Builder->CreateSExt(index, Type::getInt64Ty(*TheContext), "offset");
+  return Builder->CreateInBoundsGEP(elementType, buf, offset, "element");
+}
+
+Value *Codegen::createArrayAllocation(llvm::Type *elementType, Value *length)
+{
+  Function *allocate = TheModule->getFunction(elementType->isDoubleTy() ? "double_array" : "int_array");
+  return Builder->CreateCall(allocate, {length}, "array");
+}
+
+/* The function a call by name refers to. The vector kernels are the runtime
+   functions __vec_<name>, so a program can still define its own sum or max. */
+Function *Codegen::findCallee(std::string_view name)
+{
+  if (Function *function = TheModule->getFunction(name))
+    return function;
+  if (findFunction(name))
+    return nullptr;
+  return TheModule->getFunction("__vec_" + std::string(name));
+}
+
+/* Arrays are reference counted: a variable holds a reference, a call returns
+   one to its caller and the callee borrows its arguments. */
+void Codegen::createArrayRetain(Value *array)
+{
+  Builder->CreateCall(TheModule->getFunction("__array_retain"),
+    {Builder->CreateExtractValue(array, 0, "header")});
+}
+
+void Codegen::createArrayRelease(Value *array)
+{
+  Builder->CreateCall(TheModule->getFunction("__array_release"),
+    {Builder->CreateExtractValue(array, 0, "header")});
+}
+
+/* stores a reference the variable takes over and releases its old value;
+   the old value is released last, a = a keeps the array */
+Value *Codegen::createArrayStore(Value *array, Value *address)
+{
+  Value *old = Builder->CreateLoad(array->getType(), address, "old");
+  Value *store = Builder->CreateStore(array, address);
+  createArrayRelease(old);
+  return store;
+}
+
+/* An array variable of the current function. It is null until its
+   declaration runs, so a declaration in a loop releases the array of the
+   last iteration and a return before the declaration releases nothing. */
+AllocaInst *Codegen::createArrayVariable(llvm::Type *type, const std::string &name)
+{
+  CodegenBlock *TheBlock = GeneratingBlocks.top();
+  AllocaInst *alloca = createBlockAlloca(TheBlock->block, type, name);
+  IRBuilder<> TmpB(TheBlock->block, std::next(alloca->getIterator()));
+  TmpB.CreateStore(Constant::getNullValue(type), alloca);
+  TheBlock->arrays.push_back(alloca);
+  return alloca;
+}
+
+/* releases the array variables of the current function before its returns */
+void Codegen::releaseArrayVariables(Function *F)
+{
+  CodegenBlock *TheBlock = GeneratingBlocks.top();
+  if (TheBlock->arrays.empty())
+    return;
+  for (ReturnInst *ret : functionReturns(F))
+  {
+    Builder->SetInsertPoint(ret);
+    for (AllocaInst *alloca : TheBlock->arrays)
+      createArrayRelease(Builder->CreateLoad(alloca->getAllocatedType(), alloca));
+  }
+}
+
+/* the returns of a function, for the calls added before them; a musttail
+   call must be right before its return, so it becomes a plain tail call */
+std::vector<ReturnInst *> Codegen::functionReturns(Function *F)
+{
+  std::vector<ReturnInst *> returns;
+  for (BasicBlock &BB : *F)
+  {
+    ReturnInst *ret = dyn_cast_or_null<ReturnInst>(BB.getTerminator());
+    if (!ret)
+      continue;
+    if (CallInst *call = dyn_cast_or_null<CallInst>(ret->getPrevNode()))
+      if (call->isMustTailCall())
+        call->setTailCallKind(CallInst::TCK_Tail);
+    returns.push_back(ret);
+  }
+  return returns;
+}
+
+/* main starts the thread pool of parallel for loops and joins it when it returns */
+void Codegen::finishParallel(Function *MainFunction)
+{
+  if (TheModule->getFunction("__parallel_for")->use_empty())
+    return;
+
+  BasicBlock &entry = MainFunction->getEntryBlock();
+  Builder->SetInsertPoint(&entry, entry.getFirstInsertionPt());
+  Builder->CreateCall(TheModule->getFunction("__parallel_init"), {Builder->getInt32(ParallelThreads)});
+  Function *shutdownFn = TheModule->getFunction("__parallel_shutdown");
+  for (ReturnInst *ret : functionReturns(MainFunction))
+  {
+    Builder->SetInsertPoint(ret);
+    Builder->CreateCall(shutdownFn);
+  }
+}
+
 void Codegen::generateCode(BlockExprAST &parsedBlock, bool withOptimization = true,
   bool needPrintIR = false, std::string outputFile = "")
 {
   ConstObjCount = 0;
+  ProfiledFunctions.clear();
 
   //redirect output
   if (!outputFile.empty()) {
@@ -60,16 +237,34 @@ void Codegen::generateCode(BlockExprAST &parsedBlock, bool withOptimization = tr
     out = &outs();
   }
 
-  // create main function
-  IdentifierExprAST type = IdentifierExprAST("int");
-  IdentifierExprAST name = IdentifierExprAST(MainFunctionName);
+  // create main function; the wrapper nodes are only needed while generating it
+  IdentifierExprAST type("int");
+  IdentifierExprAST name(MainFunctionName);
   VariableList args;
-  ExprAST *returnValue = new IntExprAST(0);
-  ReturnStatementAST *returnStmt = new ReturnStatementAST(returnValue);
-  FunctionBlockAST mainBlock = FunctionBlockAST(&parsedBlock, *returnStmt);
-  FunctionDeclarationAST *main = new FunctionDeclarationAST(type, name, args, mainBlock);
+  IntExprAST returnValue(0);
+  ReturnStatementAST returnStmt(&returnValue);
+  FunctionBlockAST mainBlock(&parsedBlock, returnStmt);
+  FunctionDeclarationAST main(type, name, args, mainBlock);
 
-  main->createIR(*this, needPrintIR);
+  Value *mainFunction;
+  {
+    NamedRegionTimer timer("codegen", "IR generation", PhaseTimerGroup, PhaseTimerGroupDesc,
+      TimePassesIsEnabled);
+    mainFunction = main.createIR(*this, needPrintIR);
+    finishProfile(cast<Function>(mainFunction));
+    finishParallel(cast<Function>(mainFunction));
+  }
+
+  if (withOptimization && !LazyCompilation)
+    optimize();
+
+  InstructionCounts.clear();
+  for (Function &F : *TheModule)
+    if (!F.isDeclaration())
+      InstructionCounts.push_back({std::string(F.getName()), F.getInstructionCount()});
+
+  if (needPrintIR)
+    TheModule->print(*out, nullptr);
 }
 
 void Codegen::pp(BlockExprAST *block)
@@ -77,43 +272,153 @@ void Codegen::pp(BlockExprAST *block)
   block->pp();
 }
 
-Codegen::Codegen()
+/* "+feature,-feature" string of the host CPU, used by -march=native */
+static std::string hostCPUFeatures()
+{
+  SubtargetFeatures Features;
+  StringMap<bool> HostFeatures;
+  if (sys::getHostCPUFeatures(HostFeatures))
+    for (auto &F : HostFeatures)
+      Features.AddFeature(F.first(), F.second);
+  return Features.getString();
+}
+
+/* the target registry is process wide, sessions on other threads share it */
+static std::once_flag NativeTargetInitialized, AllTargetsInitialized;
+
+static void initializeNativeTarget()
+{
+  std::call_once(NativeTargetInitialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+  });
+}
+
+static void initializeAllTargets()
 {
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
-  InitializeNativeTargetAsmParser();
-  TheJIT = ExitOnErr(SimpleJIT::Create());
+  std::call_once(AllTargetsInitialized, [] {
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmParsers();
+    InitializeAllAsmPrinters();
+  });
+}
+
+/* done once up front by the compile server, before it forks its workers */
+void Codegen::initializeTargets()
+{
+  initializeNativeTarget();
+  initializeAllTargets();
+}
+
+Codegen::Codegen(const std::string &CPU, const std::string &Features)
+{
+  initializeNativeTarget();
+
+  TargetCPU = CPU;
+  TargetFeatures = Features;
+  if (CPU.compare("native") == 0)
+  {
+    TargetCPU = sys::getHostCPUName().str();
+    std::string HostFeatures = hostCPUFeatures();
+    // explicit -mattr features go last so they override the host ones
+    TargetFeatures = Features.empty() ? HostFeatures : HostFeatures + "," + Features;
+  }
+
+  TheJIT = ExitOnErr(SimpleJIT::Create(TargetCPU, TargetFeatures));
+  TheTargetMachine = ExitOnErr(TheJIT->getTargetMachineBuilder().createTargetMachine());
   initializeForJIT();
 }
 
+void Codegen::setOptimizationLevel(unsigned level)
+{
+  OptLevel = level;
+  initializePassManagers();
+}
+
+/* the target machine gives the vectorizers and the inliner a cost model */
+static PipelineTuningOptions tuningOptions(unsigned OptLevel)
+{
+  PipelineTuningOptions PTO;
+  PTO.LoopVectorization = OptLevel > 1;
+  PTO.SLPVectorization = OptLevel > 1;
+  PTO.LoopUnrolling = OptLevel > 1;
+  return PTO;
+}
+
+/* standard module pipeline: SROA/mem2reg, inliner, LICM, loop and SLP vectorizers */
+static ModulePassManager buildModulePipeline(PassBuilder &PB, unsigned OptLevel)
+{
+  static const OptimizationLevel Levels[] = {
+    OptimizationLevel::O0, OptimizationLevel::O1,
+    OptimizationLevel::O2, OptimizationLevel::O3
+  };
+  OptimizationLevel Level = Levels[std::min(OptLevel, 3u)];
+  // takes the array bounds checks out of loops before they are vectorized
+  PB.registerVectorizerStartEPCallback([](FunctionPassManager &FPM, OptimizationLevel Level) {
+    if (Level != OptimizationLevel::O0)
+      FPM.addPass(IRCEPass());
+  });
+  return Level == OptimizationLevel::O0
+    ? PB.buildO0DefaultPipeline(Level)
+    : PB.buildPerModuleDefaultPipeline(Level);
+}
+
 void Codegen::initializePassManagers()
 {
   // Create new pass and analysis managers.
-  TheFPM = std::make_unique<FunctionPassManager>();
   TheLAM = std::make_unique<LoopAnalysisManager>();
   TheFAM = std::make_unique<FunctionAnalysisManager>();
   TheCGAM = std::make_unique<CGSCCAnalysisManager>();
   TheMAM = std::make_unique<ModuleAnalysisManager>();
   ThePIC = std::make_unique<PassInstrumentationCallbacks>();
   TheSI = std::make_unique<StandardInstrumentations>(*TheContext,
-                                                     /*DebugLogging*/ true);
+                                                     /*DebugLogging*/ false);
   TheSI->registerCallbacks(*ThePIC, TheMAM.get());
 
-  // Add transform passes.
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  TheFPM->addPass(InstCombinePass());
-  // Reassociate expressions.
-  TheFPM->addPass(ReassociatePass());
-  // Eliminate Common SubExpressions.
-  TheFPM->addPass(GVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  TheFPM->addPass(SimplifyCFGPass());
-
-  // Register analysis passes used in these transform passes.
-  PassBuilder PB;
+  PassBuilder PB(TheTargetMachine.get(), tuningOptions(OptLevel), std::nullopt, ThePIC.get());
+
+  // Register analysis passes used in the transform passes.
   PB.registerModuleAnalyses(*TheMAM);
+  PB.registerCGSCCAnalyses(*TheCGAM);
   PB.registerFunctionAnalyses(*TheFAM);
+  PB.registerLoopAnalyses(*TheLAM);
   PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
+
+  TheMPM = std::make_unique<ModulePassManager>(buildModulePipeline(PB, OptLevel));
+}
+
+/* With lazy compilation the module is not optimized as a whole; each function
+   goes through the pipeline when it is compiled, on the JIT's threads, with
+   pass managers and a target machine of its own. */
+void Codegen::setLazyCompilation(bool enable)
+{
+  LazyCompilation = enable;
+  if (!enable)
+    return;
+
+  TheJIT->setLazyTransform([this](ThreadSafeModule TSM, MaterializationResponsibility &R)
+    -> Expected<ThreadSafeModule> {
+    auto TM = TheJIT->getTargetMachineBuilder().createTargetMachine();
+    if (!TM)
+      return TM.takeError();
+    TSM.withModuleDo([&](Module &M) {
+      LoopAnalysisManager LAM;
+      FunctionAnalysisManager FAM;
+      CGSCCAnalysisManager CGAM;
+      ModuleAnalysisManager MAM;
+      PassBuilder PB(TM->get(), tuningOptions(OptLevel));
+      PB.registerModuleAnalyses(MAM);
+      PB.registerCGSCCAnalyses(CGAM);
+      PB.registerFunctionAnalyses(FAM);
+      PB.registerLoopAnalyses(LAM);
+      PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+      buildModulePipeline(PB, OptLevel).run(M, MAM);
+    });
+    return std::move(TSM);
+  });
 }
 
 void Codegen::initializeForJIT()
@@ -122,6 +427,7 @@ void Codegen::initializeForJIT()
   TheContext = std::make_unique<LLVMContext>();
   TheModule = std::make_unique<Module>("SimpleJIT", *TheContext);
   TheModule->setDataLayout(TheJIT->getDataLayout());
+  TheModule->setTargetTriple(TheJIT->getTargetMachineBuilder().getTargetTriple().str());
   addRuntime();
 
   // Create a new builder for the module.
@@ -133,28 +439,264 @@ void Codegen::runCode(std::string inputFileName)
 {
   std::cout << "Executing " << (inputFileName.empty() ? "from stdin" : inputFileName) << "\n";
   auto RT = TheJIT->getMainJITDylib().createResourceTracker();
-  auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
-  ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
+  if (LazyCompilation)
+  {
+    // only main is compiled here, the other functions on their first call
+    auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+    ExitOnErr(TheJIT->addLazyModule(std::move(TSM), RT));
+  }
+  else if (CodegenThreads > 1)
+  {
+    // every partition is its own materialization unit, compiled on the dispatcher's threads
+    for (auto &TSM : splitModule(CodegenThreads))
+      ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
+  }
+  else
+  {
+    auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+    ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
+  }
   initializeForJIT();
 
-  auto ExprSymbol = ExitOnErr(TheJIT->lookup(MainFunctionName));
+  // the module is compiled on the first lookup
+  ExecutorSymbolDef ExprSymbol;
+  {
+    NamedRegionTimer timer("jit", "JIT compilation", PhaseTimerGroup, PhaseTimerGroupDesc,
+      TimePassesIsEnabled);
+    ExprSymbol = ExitOnErr(TheJIT->lookup(MainFunctionName));
+  }
   // Get the symbol's address and cast it to the right function pointer type and call it as a native function.
   int (*FP)() = ExprSymbol.getAddress().toPtr<int (*)()>();
   int result = FP();
+  flush();
 
   std::cout << std::endl << "Exiting..." << std::endl;
   ExitOnErr(RT->remove());
   return;
 }
 
-void Codegen::writeObjFile(BlockExprAST &mainBlock, std::string optOutputFile)
+/* The REPL compiles every input into a module of its own in this context
+   and keeps the JIT between inputs. Variables declared at the top level
+   become globals, functions are called through stubs so a redefinition
+   replaces the code of the old one; it must keep the type of the old one. */
+void Codegen::beginRepl()
+{
+  ReplScope = std::make_unique<NameScope>(NameTypes);
+}
+
+void Codegen::newReplModule(std::string_view definedFunction)
+{
+  TheModule = std::make_unique<Module>("repl" + std::to_string(ReplCount), *TheContext);
+  TheModule->setDataLayout(TheJIT->getDataLayout());
+  TheModule->setTargetTriple(TheJIT->getTargetMachineBuilder().getTargetTriple().str());
+  addRuntime();
+  // functions of earlier inputs resolve to their stubs
+  for (auto &it : ReplFunctions)
+    if (it.first != definedFunction)
+      TheModule->getOrInsertFunction(it.first, it.second.Type);
+}
+
+GlobalVariable *Codegen::defineGlobal(SymbolID id, const std::string &name, llvm::Type *type)
+{
+  // a new symbol for every declaration, older inputs keep the old variable
+  std::string symbol = name + "." + std::to_string(ReplCount);
+  ReplGlobals[id] = {symbol, type};
+  return new GlobalVariable(*TheModule, type, false, GlobalValue::ExternalLinkage,
+    Constant::getNullValue(type), symbol);
+}
+
+GlobalVariable *Codegen::findGlobal(SymbolID id)
+{
+  auto it = ReplGlobals.find(id);
+  if (it == ReplGlobals.end())
+    return nullptr;
+  if (GlobalVariable *global = TheModule->getNamedGlobal(it->second.first))
+    return global;
+  return new GlobalVariable(*TheModule, it->second.second, false, GlobalValue::ExternalLinkage,
+    nullptr, it->second.first);
+}
+
+bool Codegen::runReplStatement(StatementAST &statement)
+{
+  ReplCount++;
+  auto *function = dynamic_cast<FunctionDeclarationAST *>(&statement);
+  std::string name = function ? std::string(function->Name.get()) : "__repl" + std::to_string(ReplCount);
+  newReplModule(function ? std::string_view(name) : std::string_view());
+
+  // calls are checked against the last definition that compiled
+  auto keepOldDefinition = [&]() {
+    auto it = ReplFunctions.find(name);
+    if (it != ReplFunctions.end())
+      (*DefinedFunctions)[name] = it->second.Declaration;
+    else
+      DefinedFunctions->erase(name);
+  };
+
+  if (!statement.typeCheck(*this))
+  {
+    std::cout << "Type errors found. Can not run code." << std::endl;
+    if (function)
+      keepOldDefinition();
+    return false;
+  }
+
+  // callers compiled before call the stub with the old signature
+  auto old = function ? ReplFunctions.find(name) : ReplFunctions.end();
+  if (old != ReplFunctions.end())
+  {
+    std::vector<llvm::Type *> argTypes;
+    for (unsigned idx = 0; idx < function->Arguments.size(); idx++)
+      argTypes.push_back(function->getArgumentType(*this, idx));
+    FunctionType *type = FunctionType::get(stringTypeToLLVM(function->TypeName), argTypes, false);
+    if (type != old->second.Type)
+    {
+      std::cout << "Type errors found: " << name << " can not change its type, "
+        << "the old definition is kept" << std::endl;
+      keepOldDefinition();
+      return false;
+    }
+  }
+
+  if (function)
+  {
+    // the definition gets a symbol of its own, the name is its stub
+    Function *F = cast<Function>(function->createIR(*this));
+    FunctionType *type = F->getFunctionType();
+    std::string symbol = name + "." + std::to_string(ReplCount);
+    F->setName(symbol);
+    optimize();
+
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    ExitOnErr(TheJIT->addModule(moveToNewContext(*TheModule), RT));
+    auto Definition = ExitOnErr(TheJIT->lookup(symbol));
+    ExitOnErr(TheJIT->redirect(name, Definition.getAddress()));
+
+    if (old != ReplFunctions.end())
+      ExitOnErr(old->second.Tracker->remove());
+    ReplFunctions[name] = {RT, type, function};
+    std::cout << "Defined " << name << std::endl;
+    return true;
+  }
+
+  // other statements run in a function of their own
+  BlockExprAST block;
+  block.Statements.push_back(&statement);
+  IdentifierExprAST type("int");
+  IdentifierExprAST wrapperName(name);
+  VariableList args;
+  IntExprAST returnValue(0);
+  ReturnStatementAST returnStmt(&returnValue);
+  FunctionBlockAST wrapperBlock(&block, returnStmt);
+  FunctionDeclarationAST wrapper(type, wrapperName, args, wrapperBlock);
+
+  ReplTopLevel = true;
+  Function *F = cast<Function>(wrapper.createIR(*this));
+  ReplTopLevel = false;
+  optimize();
+
+  // the module stays, it holds the globals declared by the statement
+  auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+  ExitOnErr(TheJIT->addModule(moveToNewContext(*TheModule), RT));
+  auto Symbol = ExitOnErr(TheJIT->lookup(F->getName()));
+  Symbol.getAddress().toPtr<int (*)()>()();
+  flush();
+  return true;
+}
+
+/* A copy of the module in a context of its own, made through bitcode; the
+   copy can be compiled on another thread while this context is in use. */
+ThreadSafeModule Codegen::moveToNewContext(Module &M)
+{
+  SmallString<0> bitcode;
+  raw_svector_ostream os(bitcode);
+  WriteBitcodeToFile(M, os);
+  auto context = std::make_unique<LLVMContext>();
+  auto copy = ExitOnErr(parseBitcodeFile(MemoryBufferRef(bitcode, M.getName()), *context));
+  return ThreadSafeModule(std::move(copy), std::move(context));
+}
+
+/* Splits the optimized module for the JIT. The partitions are moved into
+   contexts of their own, so they can be compiled on different threads;
+   locals stay private and keep their users in the same partition. */
+std::vector<ThreadSafeModule> Codegen::splitModule(unsigned N)
+{
+  std::vector<ThreadSafeModule> parts;
+  SplitModule(*TheModule, N, [&](std::unique_ptr<Module> part) {
+    parts.push_back(moveToNewContext(*part));
+  }, /*PreserveLocals*/ true);
+  return parts;
+}
+
+/* Backend of the module split into N partitions on as many threads. The
+   partition objects are combined by a relocatable link in partition order,
+   so the object file is the same on every run. */
+static bool emitObjectParallel(Module &M, unsigned N,
+  const std::function<std::unique_ptr<TargetMachine>()> &createTargetMachine,
+  StringRef Linker, const std::string &Filename)
+{
+  std::vector<SmallString<0>> objects(N);
+  std::vector<std::unique_ptr<raw_svector_ostream>> streams;
+  std::vector<raw_pwrite_stream *> outputs;
+  for (auto &object : objects)
+  {
+    streams.push_back(std::make_unique<raw_svector_ostream>(object));
+    outputs.push_back(streams.back().get());
+  }
+  splitCodeGen(M, outputs, {}, createTargetMachine, CodeGenFileType::ObjectFile,
+    /*PreserveLocals*/ true);
+
+  std::vector<std::string> partFiles;
+  for (auto &object : objects)
+  {
+    int FD;
+    SmallString<128> path;
+    if (std::error_code EC = sys::fs::createTemporaryFile("part", "o", FD, path))
+    {
+      errs() << "Could not create a temporary file: " << EC.message() << "\n";
+      break;
+    }
+    raw_fd_ostream os(FD, /*shouldClose*/ true);
+    os << object;
+    partFiles.push_back(std::string(path));
+  }
+
+  int result = -1;
+  std::string errorMessage;
+  if (partFiles.size() == N)
+  {
+    std::vector<StringRef> args = {Linker, "-r", "-o", Filename};
+    args.insert(args.end(), partFiles.begin(), partFiles.end());
+    result = sys::ExecuteAndWait(Linker, args, std::nullopt, {}, 0, 0, &errorMessage);
+  }
+  for (auto &file : partFiles)
+    sys::fs::remove(file);
+
+  if (result != 0)
+  {
+    errs() << "Could not combine the partition objects with " << Linker << ": "
+           << (errorMessage.empty() ? "exit status " + std::to_string(result) : errorMessage) << "\n";
+    sys::fs::remove(Filename);
+    return false;
+  }
+  return true;
+}
+
+/* The relocatable link must understand objects of the target, so the
+   linker of a cross toolchain for the triple is preferred to the host one. */
+static ErrorOr<std::string> findRelocatableLinker(const std::string &TargetTriple)
+{
+  auto Linker = sys::findProgramByName(TargetTriple + "-ld");
+  if (Linker)
+    return Linker;
+  if (TargetTriple != sys::getProcessTriple())
+    return Linker;
+  return sys::findProgramByName("ld");
+}
+
+bool Codegen::writeObjFile(BlockExprAST &mainBlock, std::string optOutputFile)
 {
   TheModule = std::make_unique<Module>("_llvm_obj_module", *TheContext);
-  InitializeAllTargetInfos();
-  InitializeAllTargets();
-  InitializeAllTargetMCs();
-  InitializeAllAsmParsers();
-  InitializeAllAsmPrinters();
+  initializeAllTargets();
 
   auto TargetTriple = sys::getDefaultTargetTriple();
   TheModule->setTargetTriple(TargetTriple);
@@ -163,15 +705,15 @@ void Codegen::writeObjFile(BlockExprAST &mainBlock, std::string optOutputFile)
   auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
   if (!Target) {
     errs() << "Target lookup failed: " << Error;
-    return;
+    return false;
   }
 
-  auto CPU = "generic";
-  auto Features = "";
+  auto CPU = TargetCPU.empty() ? "generic" : TargetCPU;
+  auto Features = TargetFeatures;
 
   TargetOptions opt;
-  auto TheTargetMachine = Target->createTargetMachine(
-      TargetTriple, CPU, Features, opt, Reloc::PIC_);
+  TheTargetMachine.reset(Target->createTargetMachine(
+      TargetTriple, CPU, Features, opt, Reloc::PIC_));
 
   TheModule->setDataLayout(TheTargetMachine->createDataLayout());
   addRuntime();
@@ -184,7 +726,27 @@ void Codegen::writeObjFile(BlockExprAST &mainBlock, std::string optOutputFile)
 
   if (EC) {
     errs() << "Could not open file: " << EC.message();
-    return;
+    return false;
+  }
+
+  NamedRegionTimer timer("emit", "Object file emission", PhaseTimerGroup, PhaseTimerGroupDesc,
+    TimePassesIsEnabled);
+
+  ErrorOr<std::string> Linker = std::make_error_code(std::errc::no_such_file_or_directory);
+  if (CodegenThreads > 1 && !(Linker = findRelocatableLinker(TargetTriple)))
+    errs() << "Warning: no linker for " << TargetTriple << " found, -fcodegen-threads="
+           << CodegenThreads << " falls back to a single code generation thread\n";
+  if (Linker)
+  {
+    auto createTargetMachine = [&]() {
+      return std::unique_ptr<TargetMachine>(Target->createTargetMachine(
+        TargetTriple, CPU, Features, opt, Reloc::PIC_));
+    };
+    dest.close();
+    if (!emitObjectParallel(*TheModule, CodegenThreads, createTargetMachine, *Linker, Filename))
+      return false;
+    std::cout << "Wrote " << Filename << "\n";
+    return true;
   }
 
   legacy::PassManager pass;
@@ -192,18 +754,213 @@ void Codegen::writeObjFile(BlockExprAST &mainBlock, std::string optOutputFile)
 
   if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
     errs() << "TheTargetMachine can't emit a file of this type";
-    return;
+    return false;
   }
 
   pass.run(*TheModule);
   dest.flush();
 
   std::cout << "Wrote " << Filename << "\n";
+  return true;
+}
+
+/* run the module pipeline selected by the optimization level once per module */
+void Codegen::optimize()
+{
+  NamedRegionTimer timer("optimize", "Optimization pipeline", PhaseTimerGroup, PhaseTimerGroupDesc,
+    TimePassesIsEnabled);
+  TheMPM->run(*TheModule, *TheMAM);
+  // cached analyses are keyed by address, which a later module may reuse
+  TheMAM->clear();
+}
+
+/* The JIT is created again with the cache attached to its compile layer;
+   nothing has been added to the old one yet. */
+void Codegen::setJITCache(const std::string &directory, uint64_t maxSizeBytes)
+{
+  TheCache = std::make_unique<DiskObjectCache>(directory, maxSizeBytes, TargetCPU, TargetFeatures);
+  TheJIT = ExitOnErr(SimpleJIT::Create(TargetCPU, TargetFeatures, TheCache.get()));
+  setLazyCompilation(LazyCompilation);
+}
+
+void Codegen::printStatistics(llvm::raw_ostream &os)
+{
+  os << "IR instructions per function:\n";
+  for (auto &it : InstructionCounts)
+    os << "  " << it.first << ": " << it.second << "\n";
+  os << "IR instructions total: " << getInstructionCount() << "\n";
+  if (TheCache)
+    os << "JIT cache: " << TheCache->Hits << " hits, " << TheCache->Misses << " misses\n";
+}
+
+unsigned Codegen::getInstructionCount()
+{
+  unsigned total = 0;
+  for (auto &it : InstructionCounts)
+    total += it.second;
+  return total;
+}
+
+/* Reads counters written by a -fprofile-generate run:
+   "<function> <number of counters>" followed by the counter values */
+bool Codegen::loadProfile(const std::string &fileName)
+{
+  std::ifstream in(fileName);
+  if (!in)
+  {
+    std::cerr << "Can not open profile " << fileName << std::endl;
+    return false;
+  }
+  // every counter takes a digit and a separator, a larger count is not a profile
+  uint64_t fileSize = 0;
+  sys::fs::file_size(fileName, fileSize);
+  auto invalid = [&](const std::string &why) {
+    std::cerr << "Invalid profile " << fileName << ": " << why << std::endl;
+    ProfileCounts.clear();
+    return false;
+  };
+  std::string name;
+  uint64_t numCounters;
+  while (in >> name)
+  {
+    if (!(in >> numCounters))
+      return invalid("no number of counters for " + name);
+    if (numCounters > fileSize / 2)
+      return invalid(std::to_string(numCounters) + " counters for " + name);
+    std::vector<uint64_t> counts(numCounters);
+    for (uint64_t i = 0; i < numCounters; i++)
+      if (!(in >> counts[i]))
+        return invalid("the counters of " + name + " are cut off");
+    ProfileCounts[name] = std::move(counts);
+  }
+  if (!in.eof())
+    return invalid("can not read the file");
+  return true;
+}
+
+void Codegen::beginFunctionProfile(Function *F)
+{
+  FunctionProfile profile;
+  if (ProfileGenerate)
+  {
+    // the counter array size is known when the function is finished,
+    // the placeholder is replaced in endFunctionProfile
+    profile.Counters = new GlobalVariable(*TheModule, Type::getInt64Ty(*TheContext), false,
+      GlobalValue::PrivateLinkage, nullptr, "__prof_placeholder");
+  }
+  auto it = ProfileCounts.find(std::string(F->getName()));
+  if (it != ProfileCounts.end() && !it->second.empty())
+  {
+    profile.Counts = &it->second;
+    F->setEntryCount(it->second[0]);
+  }
+  ProfilingFunctions.push(profile);
+  emitProfileCounter(); // counter 0 is the function entry
 }
 
-void Codegen::optimize(llvm::Function *TheFunction)
+void Codegen::endFunctionProfile()
 {
-  TheFPM->run(*TheFunction, *TheFAM);
+  FunctionProfile &profile = ProfilingFunctions.top();
+  if (profile.Counts && profile.Counts->size() != profile.NumCounters)
+  {
+    std::cerr << "Warning: profile for " << currentFunction()->getName().str()
+      << " does not match the source, ignored" << std::endl;
+    currentFunction()->setMetadata(LLVMContext::MD_prof, nullptr);
+    for (BasicBlock &BB : *currentFunction())
+      if (Instruction *terminator = BB.getTerminator())
+        terminator->setMetadata(LLVMContext::MD_prof, nullptr);
+  }
+  if (profile.Counters)
+  {
+    auto counterType = ArrayType::get(Type::getInt64Ty(*TheContext), profile.NumCounters);
+    std::string fnName = std::string(currentFunction()->getName());
+    auto counters = new GlobalVariable(*TheModule, counterType, false,
+      GlobalValue::PrivateLinkage, ConstantAggregateZero::get(counterType), "__prof_" + fnName);
+    profile.Counters->replaceAllUsesWith(counters);
+    profile.Counters->eraseFromParent();
+    ProfiledFunctions.push_back({fnName, counters});
+  }
+  ProfilingFunctions.pop();
+}
+
+/* Increments the next counter of the current function at the insert point.
+   Counters are numbered in codegen order, so the same source gets the same numbers.
+   With parallel for loops any function may run on several workers at once, so
+   the increments are atomic; monotonic is enough as only the totals are read. */
+unsigned Codegen::emitProfileCounter()
+{
+  FunctionProfile &profile = ProfilingFunctions.top();
+  unsigned idx = profile.NumCounters++;
+  if (!profile.Counters)
+    return idx;
+
+  llvm::Type *counterType = Type::getInt64Ty(*TheContext);
+  Value *addr = Builder->CreateConstInBoundsGEP1_32(counterType, profile.Counters, idx);
+  Value *one = ConstantInt::get(counterType, 1);
+  if (HasParallelLoops)
+  {
+    Builder->CreateAtomicRMW(AtomicRMWInst::Add, addr, one, MaybeAlign(8), AtomicOrdering::Monotonic);
+    return idx;
+  }
+  Value *count = Builder->CreateLoad(counterType, addr, "prof");
+  Builder->CreateStore(Builder->CreateAdd(count, one), addr);
+  return idx;
+}
+
+void Codegen::setBranchWeights(BranchInst *Br, unsigned TakenCounter, unsigned NotTakenCounter)
+{
+  const std::vector<uint64_t> *counts = ProfilingFunctions.top().Counts;
+  if (!counts || std::max(TakenCounter, NotTakenCounter) >= counts->size())
+    return;
+
+  // branch weights are 32 bit
+  uint64_t taken = (*counts)[TakenCounter], notTaken = (*counts)[NotTakenCounter];
+  uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+  MDBuilder MDB(*TheContext);
+  Br->setMetadata(LLVMContext::MD_prof,
+    MDB.createBranchWeights(taken / scale, notTaken / scale));
+}
+
+/* registers the counters and writes them when main returns; attaches the profile summary */
+void Codegen::finishProfile(Function *MainFunction)
+{
+  if (!ProfileCounts.empty())
+  {
+    InstrProfSummaryBuilder SummaryBuilder(ProfileSummaryBuilder::DefaultCutoffs);
+    for (auto &it : ProfileCounts)
+    {
+      if (it.second.empty())
+        continue;
+      InstrProfRecord record;
+      record.Counts = it.second;
+      SummaryBuilder.addRecord(record);
+    }
+    TheModule->setProfileSummary(
+      SummaryBuilder.getSummary()->getMD(*TheContext), ProfileSummary::PSK_Instr);
+  }
+
+  if (!ProfileGenerate)
+    return;
+
+  BasicBlock &entry = MainFunction->getEntryBlock();
+  Builder->SetInsertPoint(&entry, entry.getFirstInsertionPt());
+  Value *fileName = Builder->CreateGlobalStringPtr(ProfileFile);
+  Builder->CreateCall(TheModule->getFunction("__prof_init"), {fileName});
+  Function *registerFn = TheModule->getFunction("__prof_register");
+  for (auto &it : ProfiledFunctions)
+  {
+    Value *name = Builder->CreateGlobalStringPtr(it.first);
+    Value *numCounters = ConstantInt::get(Type::getInt32Ty(*TheContext),
+      cast<ArrayType>(it.second->getValueType())->getNumElements());
+    Builder->CreateCall(registerFn, {name, it.second, numCounters});
+  }
+
+  Function *writeFn = TheModule->getFunction("__prof_write");
+  for (ReturnInst *ret : functionReturns(MainFunction))
+  {
+    Builder->SetInsertPoint(ret);
+    Builder->CreateCall(writeFn, {fileName});
+  }
 }
 
 /* Returns an LLVM type based on the identifier */
@@ -217,11 +974,38 @@ llvm::Type *Codegen::stringTypeToLLVM(const IdentifierExprAST &type)
     return Type::getVoidTy(*TheContext);
   if (type.Name.compare("string") == 0)
     return PointerType::getUnqual(Type::getInt8Ty(*TheContext)); /* pointer */
+  if (type.Name.compare("int[]") == 0)
+    return arrayType(Type::getInt32Ty(*TheContext));
+  if (type.Name.compare("double[]") == 0)
+    return arrayType(Type::getDoubleTy(*TheContext));
 
   std::cerr << "Unknown type: " << type.Name << std::endl;
   return Type::getVoidTy(*TheContext);
 }
 
+/* int[] and double[] are a pointer to an Array wrapped in a named struct,
+   so that they are types of their own and not the pointer type of string */
+StructType *Codegen::arrayType(llvm::Type *elementType)
+{
+  const char *name = elementType->isDoubleTy() ? "double[]" : "int[]";
+  if (StructType *type = StructType::getTypeByName(*TheContext, name))
+    return type;
+  return StructType::create(*TheContext, {PointerType::getUnqual(*TheContext)}, name);
+}
+
+/* element type of an array type, nullptr for the other types */
+llvm::Type *Codegen::arrayElementType(llvm::Type *type)
+{
+  StructType *structType = dyn_cast_or_null<StructType>(type);
+  if (!structType || !structType->hasName())
+    return nullptr;
+  if (structType->getName() == "int[]")
+    return Type::getInt32Ty(*TheContext);
+  if (structType->getName() == "double[]")
+    return Type::getDoubleTy(*TheContext);
+  return nullptr;
+}
+
 bool Codegen::isTypeConversionPossible(llvm::Type *a, llvm::Type *b)
 {
   llvm::Type *intType = Type::getInt32Ty(*TheContext);
@@ -231,9 +1015,8 @@ bool Codegen::isTypeConversionPossible(llvm::Type *a, llvm::Type *b)
 
 bool Codegen::typeCheck(BlockExprAST &mainBlock)
 {
-  // construct the name => type table for the main block
-  NameTable *Names = new NameTable();
-  NameTypesByBlock.push_back(Names);
+  // open the name => type scope of the main block
+  NameScope scope(NameTypes);
   bool result = mainBlock.typeCheck(*this);
   return result;
 }
@@ -248,6 +1031,8 @@ std::string Codegen::print(llvm::Type *type)
     return std::string("void");
   if (type == PointerType::getUnqual(Type::getInt8Ty(*TheContext)))
     return std::string("string");
+  if (llvm::Type *elementType = arrayElementType(type))
+    return print(elementType) + "[]";
   return std::string("unknown type");
 }
 
@@ -304,6 +1089,12 @@ void Codegen::addRuntime()
           Type::getInt32Ty(*TheContext),
           {Type::getDoubleTy(*TheContext)},
           false));
+  TheModule->getOrInsertFunction(
+      "printr",
+      FunctionType::get(
+          Type::getInt32Ty(*TheContext),
+          {Type::getDoubleTy(*TheContext)},
+          false));
   TheModule->getOrInsertFunction(
       "print",
       FunctionType::get(
@@ -318,6 +1109,24 @@ void Codegen::addRuntime()
         {Type::getInt8Ty(*TheContext)->getPointerTo()},
         true /* variadic func */
       ));
+  TheModule->getOrInsertFunction(
+      "flush",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {},
+        false));
+  TheModule->getOrInsertFunction(
+      "output_file",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {Type::getInt8Ty(*TheContext)->getPointerTo()},
+        false));
+  TheModule->getOrInsertFunction(
+      "output_stdout",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {},
+        false));
   TheModule->getOrInsertFunction(
       "readi",
       FunctionType::get(
@@ -339,4 +1148,183 @@ void Codegen::addRuntime()
         {},
         true /* variadic func */
       ));
+  TheModule->getOrInsertFunction(
+      "next_int",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {},
+        false));
+  TheModule->getOrInsertFunction(
+      "next_double",
+      FunctionType::get(
+        Type::getDoubleTy(*TheContext),
+        {},
+        false));
+  TheModule->getOrInsertFunction(
+      "has_next",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {},
+        false));
+  /* ARRAYS: a one pointer struct is passed and returned like the Array pointer */
+  TheModule->getOrInsertFunction(
+      "int_array",
+      FunctionType::get(
+        arrayType(Type::getInt32Ty(*TheContext)),
+        {Type::getInt32Ty(*TheContext)},
+        false));
+  TheModule->getOrInsertFunction(
+      "double_array",
+      FunctionType::get(
+        arrayType(Type::getDoubleTy(*TheContext)),
+        {Type::getInt32Ty(*TheContext)},
+        false));
+  TheModule->getOrInsertFunction(
+      "__array_grow",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {PointerType::getUnqual(*TheContext)},
+        false));
+  Function *boundsFn = cast<Function>(TheModule->getOrInsertFunction(
+      "__array_bounds",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {Type::getInt32Ty(*TheContext), Type::getInt32Ty(*TheContext)},
+        false)).getCallee());
+  // it only prints and exits, the arrays stay in registers across the checks
+  boundsFn->setDoesNotReturn();
+  boundsFn->setDoesNotThrow();
+  boundsFn->setOnlyAccessesInaccessibleMemory();
+  boundsFn->addFnAttr(Attribute::Cold);
+  for (const char *name : {"__array_retain", "__array_release"})
+    TheModule->getOrInsertFunction(
+        name,
+        FunctionType::get(
+          Type::getVoidTy(*TheContext),
+          {PointerType::getUnqual(*TheContext)},
+          false));
+  /* BULK INPUT into int[] and double[] */
+  TheModule->getOrInsertFunction(
+      "read_ints",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {arrayType(Type::getInt32Ty(*TheContext))},
+        false));
+  TheModule->getOrInsertFunction(
+      "read_doubles",
+      FunctionType::get(
+        Type::getInt32Ty(*TheContext),
+        {arrayType(Type::getDoubleTy(*TheContext))},
+        false));
+  TheModule->getOrInsertFunction(
+      "read_all_ints",
+      FunctionType::get(
+        arrayType(Type::getInt32Ty(*TheContext)),
+        {},
+        false));
+  TheModule->getOrInsertFunction(
+      "read_all_doubles",
+      FunctionType::get(
+        arrayType(Type::getDoubleTy(*TheContext)),
+        {},
+        false));
+  /* CSV FILES: a file is an int handle, its columns int[] or double[] */
+  llvm::Type *int32Type = Type::getInt32Ty(*TheContext);
+  llvm::Type *stringType = Type::getInt8Ty(*TheContext)->getPointerTo();
+  const struct
+  {
+    const char *name;
+    llvm::Type *result;
+    std::vector<llvm::Type *> params;
+  } csvFunctions[] = {
+    {"csv_open", int32Type, {stringType}},
+    {"csv_rows", int32Type, {int32Type}},
+    {"csv_columns", int32Type, {int32Type}},
+    {"csv_column", int32Type, {int32Type, stringType}},
+    {"csv_name", stringType, {int32Type, int32Type}},
+    {"csv_ints", arrayType(int32Type), {int32Type, int32Type}},
+    {"csv_doubles", arrayType(Type::getDoubleTy(*TheContext)), {int32Type, int32Type}},
+    {"csv_close", int32Type, {int32Type}},
+  };
+  for (auto &csvFunction : csvFunctions)
+    TheModule->getOrInsertFunction(
+        csvFunction.name,
+        FunctionType::get(csvFunction.result, csvFunction.params, false));
+  /* VECTOR KERNELS on double[]: the reductions only read memory, the others
+     update the array in place and return it; see findCallee for their names */
+  llvm::Type *doubleType = Type::getDoubleTy(*TheContext);
+  llvm::Type *doubleArrayType = arrayType(doubleType);
+  const struct
+  {
+    const char *name;
+    llvm::Type *result;
+    std::vector<llvm::Type *> params;
+    bool readOnly;
+  } vectorKernels[] = {
+    {"__vec_sum", doubleType, {doubleArrayType}, true},
+    {"__vec_dot", doubleType, {doubleArrayType, doubleArrayType}, true},
+    {"__vec_axpy", doubleArrayType, {doubleType, doubleArrayType, doubleArrayType}, false},
+    {"__vec_scale", doubleArrayType, {doubleArrayType, doubleType}, false},
+    {"__vec_min", doubleType, {doubleArrayType}, true},
+    {"__vec_max", doubleType, {doubleArrayType}, true},
+    {"__vec_prefix_sum", doubleArrayType, {doubleArrayType}, false},
+    {"__vec_vsin", doubleArrayType, {doubleArrayType}, false},
+    {"__vec_vcos", doubleArrayType, {doubleArrayType}, false},
+    {"__vec_vsqrt", doubleArrayType, {doubleArrayType}, false},
+  };
+  for (auto &kernel : vectorKernels)
+  {
+    Function *kernelFn = cast<Function>(TheModule->getOrInsertFunction(
+        kernel.name,
+        FunctionType::get(kernel.result, kernel.params, false)).getCallee());
+    kernelFn->setDoesNotThrow();
+    if (kernel.readOnly)
+      kernelFn->setOnlyReadsMemory();
+  }
+  /* PARALLEL FOR: the body and the merge of the partial results are outlined functions */
+  TheModule->getOrInsertFunction(
+      "__parallel_init",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {Type::getInt32Ty(*TheContext)},
+        false));
+  TheModule->getOrInsertFunction(
+      "__parallel_for",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {PointerType::getUnqual(*TheContext),
+         PointerType::getUnqual(*TheContext),
+         Type::getInt32Ty(*TheContext),
+         Type::getInt32Ty(*TheContext),
+         PointerType::getUnqual(*TheContext),
+         PointerType::getUnqual(*TheContext),
+         Type::getInt64Ty(*TheContext)},
+        false));
+  TheModule->getOrInsertFunction(
+      "__parallel_shutdown",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {},
+        false));
+  /* PROFILING, used by -fprofile-generate */
+  TheModule->getOrInsertFunction(
+      "__prof_init",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {Type::getInt8Ty(*TheContext)->getPointerTo()},
+        false));
+  TheModule->getOrInsertFunction(
+      "__prof_register",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {Type::getInt8Ty(*TheContext)->getPointerTo(),
+         Type::getInt64Ty(*TheContext)->getPointerTo(),
+         Type::getInt32Ty(*TheContext)},
+        false));
+  TheModule->getOrInsertFunction(
+      "__prof_write",
+      FunctionType::get(
+        Type::getVoidTy(*TheContext),
+        {Type::getInt8Ty(*TheContext)->getPointerTo()},
+        false));
 }
@@ -1,41 +1,59 @@
 
 #include "SimpleJIT.h"
+#include "objectcache.h"
+#include "runtime.h"
 
+#include <algorithm>
 #include <map>
+#include <mutex>
 #include <stack>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #include <string>
+#include <thread>
 #include <vector>
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/PassManager.h"
 /* compile to object file: */
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/MC/TargetRegistry.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/SubtargetFeature.h"
 /* -compile to object file: */
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/CodeGen/ParallelCG.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Pass.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Scalar/InductiveRangeCheckElimination.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
 
 using namespace llvm;
 using namespace llvm::orc;
@@ -47,34 +65,114 @@ class CodegenBlock
 {
 public:
   BasicBlock *block;
-  std::map<std::string, AllocaInst *> locals;
+  DenseMap<SymbolID, AllocaInst *> locals;
+  /* self tail calls store the arguments and jump to the start of the body */
+  std::vector<AllocaInst *> arguments;
+  BasicBlock *tailRecurseBlock = nullptr;
+  /* array variables and arguments, released when the function returns */
+  std::vector<AllocaInst *> arrays;
 };
 
-typedef std::map<std::string, llvm::Type *> NameTable;
-typedef struct {
-  int refCount;
-  int elemSize;
-  int length;
-  int maxLength;
-  void *buf;
-} Array;
+/* -ftime-report timer group of the compile phases */
+static const char *PhaseTimerGroup = "phases";
+static const char *PhaseTimerGroupDesc = "Compile phases";
+
+/* profile counters of the function being generated */
+class FunctionProfile
+{
+public:
+  GlobalVariable *Counters = nullptr; // -fprofile-generate: counter array
+  unsigned NumCounters = 0;
+  const std::vector<uint64_t> *Counts = nullptr; // -fprofile-use: loaded counts
+};
+
+/* maps identifier names to SymbolIDs */
+class SymbolInterner
+{
+  StringMap<SymbolID> IDs;
+
+public:
+  SymbolID intern(StringRef Name)
+  {
+    SymbolID next = IDs.size();
+    return IDs.try_emplace(Name, next).first->second;
+  }
+};
+
+/* name => type table; a NameScope opens a scope that is popped when it is destroyed */
+typedef ScopedHashTable<SymbolID, llvm::Type *> NameTable;
+typedef ScopedHashTableScope<SymbolID, llvm::Type *> NameScope;
+
+/* field numbers of the Array header in runtime.h */
+enum ArrayField { ArrayRefCount, ArrayElemSize, ArrayLength, ArrayMaxLength, ArrayBuf };
 
 class Codegen
 {
   std::string MainFunctionName = std::string("main");
   int ConstObjCount = 0;
 
-  /* LLVM modules and JIT module */
+  /* LLVM modules and JIT module; the cache outlives the JIT using it */
+  std::unique_ptr<DiskObjectCache> TheCache;
   std::unique_ptr<SimpleJIT> TheJIT;
-  std::unique_ptr<FunctionPassManager> TheFPM;
+  std::unique_ptr<ModulePassManager> TheMPM;
   std::unique_ptr<LoopAnalysisManager> TheLAM;
   std::unique_ptr<FunctionAnalysisManager> TheFAM;
   std::unique_ptr<CGSCCAnalysisManager> TheCGAM;
   std::unique_ptr<ModuleAnalysisManager> TheMAM;
   std::unique_ptr<PassInstrumentationCallbacks> ThePIC;
   std::unique_ptr<StandardInstrumentations> TheSI;
+  std::unique_ptr<TargetMachine> TheTargetMachine;
   ExitOnError ExitOnErr;
 
+  /* optimization level set by -O0..-O3 */
+  unsigned OptLevel = 2;
+
+  /* target CPU and features set by -march/-mcpu/-mattr; empty means generic */
+  std::string TargetCPU;
+  std::string TargetFeatures;
+
+  /* the optimized module is split into this many partitions whose backend
+     runs in parallel, see -fcodegen-threads */
+  unsigned CodegenThreads = 1;
+  std::vector<ThreadSafeModule> splitModule(unsigned N);
+
+  /* array indexes are checked against the length, see -fno-bounds-check */
+  bool BoundsChecks = true;
+
+  /* workers of the parallel for thread pool, see -threads; 0 for one per core */
+  unsigned ParallelThreads = 0;
+
+  /* functions are optimized and compiled on their first call, see -lazy */
+  bool LazyCompilation = false;
+
+  /* profile-guided optimization, see -fprofile-generate and -fprofile-use */
+  bool ProfileGenerate = false;
+  std::string ProfileFile = "default.prof";
+  std::map<std::string, std::vector<uint64_t>> ProfileCounts;
+  std::vector<std::pair<std::string, GlobalVariable *>> ProfiledFunctions;
+  std::stack<FunctionProfile> ProfilingFunctions;
+  std::vector<ReturnInst *> functionReturns(Function *F);
+  void finishProfile(Function *MainFunction);
+  void finishParallel(Function *MainFunction);
+
+  /* the REPL, see beginRepl */
+  struct ReplDefinition
+  {
+    ResourceTrackerSP Tracker;
+    FunctionType *Type;
+    FunctionDeclarationAST *Declaration;
+  };
+  bool ReplTopLevel = false;
+  unsigned ReplCount = 0;
+  std::unique_ptr<NameScope> ReplScope;
+  std::map<SymbolID, std::pair<std::string, llvm::Type *>> ReplGlobals;
+  std::map<std::string, ReplDefinition, std::less<>> ReplFunctions;
+  void newReplModule(std::string_view definedFunction);
+  ThreadSafeModule moveToNewContext(Module &M);
+
+  /* IR instructions per function of the last generated module, see -stats */
+  std::vector<std::pair<std::string, unsigned>> InstructionCounts;
+
 public:
   /* LLVM resources */
   std::unique_ptr<LLVMContext> TheContext;
@@ -83,17 +181,35 @@ public:
   llvm::raw_ostream *out; // redirected output fd
 
   /* symbol tables */
-  std::map<std::string, AllocaInst *> NamedValues;
-  std::map<std::string, FunctionDeclarationAST *> *DefinedFunctions;
-  std::vector<NameTable *> NameTypesByBlock;
-  std::vector<Array *> AllocatedArrays;
+  SymbolInterner Symbols;
+  NameTable NameTypes;
+  FunctionMap *DefinedFunctions;
+  unsigned ParallelLoopDepth = 0; /* while type checking parallel for bodies */
+  /* per parallel for loop being type checked, the variables its body may
+     assign: the reductions and the variables declared in the body; the
+     others are copies of the chunk, see isPrivateInParallelLoop */
+  std::vector<DenseSet<SymbolID>> ParallelPrivates;
+  bool HasParallelLoops = false;  /* found by type checking; profile counters are then atomic */
 
   /* data structures for tracking the current block and function */
   std::stack<CodegenBlock *> GeneratingBlocks;
   std::stack<Function *> GeneratingFunctions;
 
   /* methods */
-  Codegen();
+  Codegen(const std::string &CPU = "", const std::string &Features = "");
+  static void initializeTargets();
+  void setOptimizationLevel(unsigned level);
+  void setProfileGenerate(bool enable, const std::string &file = "default.prof")
+  {
+    ProfileGenerate = enable;
+    ProfileFile = file;
+  }
+  void setLazyCompilation(bool enable);
+  void setBoundsChecks(bool enable) { BoundsChecks = enable; }
+  void setParallelThreads(unsigned N) { ParallelThreads = N; }
+  void setJITCache(const std::string &directory, uint64_t maxSizeBytes);
+  void setCodegenThreads(unsigned N) { CodegenThreads = N ? N : std::max(1u, std::thread::hardware_concurrency()); }
+  bool loadProfile(const std::string &fileName);
   void initializePassManagers();
   void initializeForJIT();
   void addRuntime();
@@ -102,19 +218,49 @@ public:
   bool typeCheck(BlockExprAST &block);
   void generateCode(BlockExprAST &block, bool withOptimization, bool needPrintIR, std::string outputFile);
   void runCode(std::string inputFileName);
-  void writeObjFile(BlockExprAST &block, std::string optOutputFile);
-  void optimize(llvm::Function *TheFunction);
+  bool writeObjFile(BlockExprAST &block, std::string optOutputFile);
+  void optimize();
+
+  /* incremental compilation of the REPL */
+  void beginRepl();
+  bool runReplStatement(StatementAST &statement);
+  bool isReplTopLevel() { return ReplTopLevel && GeneratingFunctions.size() == 1; }
+  GlobalVariable *defineGlobal(SymbolID id, const std::string &name, llvm::Type *type);
+  GlobalVariable *findGlobal(SymbolID id);
+  void printStatistics(llvm::raw_ostream &os);
+  unsigned getInstructionCount();
 
   /* code generation functions */
   AllocaInst *createBlockAlloca(BasicBlock *BB, llvm::Type *type, const std::string &VarName);
   Value *createTypeCast(std::unique_ptr<IRBuilder<>> const &Builder, Value *value, llvm::Type *type);
   Value *createNonZeroCmp(std::unique_ptr<IRBuilder<>> const &Builder, Value *value);
   const std::string genStrConstantName();
+  void setTargetAttributes(Function *F);
+
+  /* arrays: int[] and double[] values point to an Array of runtime.h */
+  Value *createArrayFieldLoad(Value *array, ArrayField field);
+  void createArrayFieldStore(Value *array, ArrayField field, Value *value);
+  Value *createArrayElementAddress(Value *array, Value *index, llvm::Type *elementType);
+  Value *createArrayAllocation(llvm::Type *elementType, Value *length);
+  void createArrayRetain(Value *array);
+  void createArrayRelease(Value *array);
+  Value *createArrayStore(Value *array, Value *address);
+  AllocaInst *createArrayVariable(llvm::Type *type, const std::string &name);
+  void releaseArrayVariables(Function *F);
+  MDNode *arrayTBAA(StringRef name);
+
+  /* profile instrumentation and branch weights */
+  void beginFunctionProfile(Function *F);
+  void endFunctionProfile();
+  unsigned emitProfileCounter();
+  void setBranchWeights(BranchInst *Br, unsigned TakenCounter, unsigned NotTakenCounter);
 
   /* type helpers */
   llvm::Type *stringTypeToLLVM(const IdentifierExprAST &type);
   std::string print(llvm::Type *type);
   bool isTypeConversionPossible(llvm::Type *a, llvm::Type *b);
+  StructType *arrayType(llvm::Type *elementType);
+  llvm::Type *arrayElementType(llvm::Type *type);
 
   /* current block and function */
   Function *currentFunction() { return GeneratingFunctions.top(); }
@@ -133,8 +279,14 @@ public:
     GeneratingBlocks.pop();
     delete top;
   }
-  void setFunctionList(std::map<std::string, FunctionDeclarationAST *> *DF)
+  void setFunctionList(FunctionMap *DF)
   {
     DefinedFunctions = DF;
   }
+  FunctionDeclarationAST *findFunction(std::string_view name)
+  {
+    auto it = DefinedFunctions->find(name);
+    return it != DefinedFunctions->end() ? it->second : nullptr;
+  }
+  Function *findCallee(std::string_view name);
 };
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <thread>
+#include "AST.h"
+#include "codegen.h"
+#include "session.h"
+#include "driver.h"
+
+namespace fs = std::filesystem;
+
+/* outcome of one input, reported in the summary */
+struct BuildResult
+{
+  std::string ObjectFile;
+  const char *Failure = nullptr; /* the phase that failed */
+  double Seconds = 0;
+  /* -stats */
+  int Tokens = 0;
+  size_t Nodes = 0, Functions = 0;
+  unsigned Instructions = 0;
+};
+
+std::vector<std::string> expandInputs(const std::vector<std::string> &inputs)
+{
+  std::vector<std::string> files;
+  for (auto &input : inputs)
+  {
+    std::error_code EC;
+    if (!fs::is_directory(input, EC))
+    {
+      files.push_back(input);
+      continue;
+    }
+    std::vector<std::string> sources;
+    for (auto &entry : fs::directory_iterator(input, EC))
+      if (entry.is_regular_file(EC) && entry.path().extension() == ".t")
+        sources.push_back(entry.path().string());
+    std::sort(sources.begin(), sources.end());
+    files.insert(files.end(), sources.begin(), sources.end());
+  }
+  return files;
+}
+
+static std::string objectFileName(const std::string &input, const std::string &outputDir)
+{
+  fs::path object = fs::path(input).filename().replace_extension(".o");
+  return outputDir.empty() ? object.string() : (fs::path(outputDir) / object).string();
+}
+
+/* one file from source to object; runs on a worker thread */
+static void buildFile(const std::string &input, const BuildOptions &options, BuildResult &result)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  FILE *f = fopen(input.c_str(), "rt");
+  if (!f)
+  {
+    result.Failure = "can not open file";
+    return;
+  }
+
+  CompilationSession session(options.CPU, options.Features);
+  session.Context.setOptimizationLevel(options.OptLevel);
+  session.Context.setCodegenThreads(options.CodegenThreads);
+  session.Context.setBoundsChecks(options.BoundsChecks);
+  session.Context.setParallelThreads(options.ParallelThreads);
+  session.Context.setProfileGenerate(options.ProfileGenerate);
+  bool isRead = session.readSource(f);
+  fclose(f);
+
+  if (!options.ProfileUse.empty() && !session.Context.loadProfile(options.ProfileUse))
+    result.Failure = "can not read profile";
+  else if (!isRead)
+    result.Failure = "can not read file";
+  else if (!session.parse())
+    result.Failure = "syntax errors";
+  else if (!session.Context.typeCheck(*session.ProgramBlock))
+    result.Failure = "type errors";
+  else if (!session.Context.writeObjFile(*session.ProgramBlock, result.ObjectFile))
+    result.Failure = "can not write object file";
+
+  result.Tokens = session.Input.nTokens;
+  result.Nodes = session.Arena.size();
+  result.Functions = session.DefinedFunctions.size();
+  result.Instructions = session.Context.getInstructionCount();
+
+  result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned buildFiles(const std::vector<std::string> &inputs, const BuildOptions &options)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::vector<BuildResult> results(inputs.size());
+
+  // two inputs of the same file name would write the same object file at once
+  std::map<std::string, size_t> objectFiles;
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    results[i].ObjectFile = objectFileName(inputs[i], options.OutputDir);
+    if (!objectFiles.emplace(results[i].ObjectFile, i).second)
+      results[i].Failure = "object file name already used by another input";
+  }
+  if (!options.OutputDir.empty())
+  {
+    std::error_code EC;
+    fs::create_directories(options.OutputDir, EC);
+  }
+
+  // largest files first, so that a big file started last does not hold up the build
+  std::vector<size_t> order(inputs.size());
+  std::vector<uintmax_t> sizes(inputs.size());
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    std::error_code EC;
+    order[i] = i;
+    sizes[i] = fs::file_size(inputs[i], EC);
+    if (EC)
+      sizes[i] = 0;
+  }
+  std::stable_sort(order.begin(), order.end(),
+    [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+  // workers take the next file from the shared queue until it is empty
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < order.size(); i = next++)
+      if (!results[order[i]].Failure)
+        buildFile(inputs[order[i]], options, results[order[i]]);
+  };
+
+  unsigned jobs = options.Jobs ? options.Jobs : std::max(1u, std::thread::hardware_concurrency());
+  jobs = std::min<size_t>(jobs, std::max<size_t>(inputs.size(), 1));
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < jobs; i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto &t : workers)
+    t.join();
+
+  // summary in the order the files were given
+  unsigned failed = 0;
+  std::cout << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    if (results[i].Failure)
+    {
+      failed++;
+      std::cout << "  FAILED   " << inputs[i] << ": " << results[i].Failure << "\n";
+    }
+    else
+      std::cout << "  " << std::setw(7) << results[i].Seconds << " s  " << inputs[i]
+                << " -> " << results[i].ObjectFile << "\n";
+    if (options.Stats)
+      std::cout << "           " << results[i].Tokens << " tokens, " << results[i].Nodes
+                << " AST nodes, " << results[i].Functions << " functions, "
+                << results[i].Instructions << " IR instructions\n";
+  }
+  std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+  std::cout << "Compiled " << inputs.size() - failed << " of " << inputs.size() << " files in "
+            << total.count() << " s with " << jobs << " jobs" << std::endl;
+  return failed;
+}
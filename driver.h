@@ -0,0 +1,31 @@
+/* Multi-file builds: every input is compiled to its own object file in a
+   CompilationSession of its own, on a pool of worker threads. */
+#ifndef BUILD_DRIVER_H_
+#define BUILD_DRIVER_H_
+
+#include <string>
+#include <vector>
+
+/* options applied to every file of a build */
+struct BuildOptions
+{
+  unsigned OptLevel = 2;
+  std::string CPU, Features;
+  std::string OutputDir; /* objects go next to the working directory if empty */
+  unsigned Jobs = 0;     /* 0: one worker per hardware thread */
+  unsigned CodegenThreads = 1;
+  bool BoundsChecks = true;
+  unsigned ParallelThreads = 0; /* 0: parallel for loops use one thread per core */
+  bool ProfileGenerate = false;
+  std::string ProfileUse; /* read by every session, empty for none */
+  bool Stats = false;     /* adds the size of every file to the summary */
+};
+
+/* replaces directories by the .t files they contain, sorted by name */
+std::vector<std::string> expandInputs(const std::vector<std::string> &inputs);
+
+/* compiles the inputs and prints the time or failure of every file;
+   returns the number of files that failed */
+unsigned buildFiles(const std::vector<std::string> &inputs, const BuildOptions &options);
+
+#endif /* BUILD_DRIVER_H_ */
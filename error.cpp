@@ -2,6 +2,12 @@
  *
  * Author: Christian Hagen, chagen@de.ibm.com
  */
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "AST.h"
 #include "error.h"
 
@@ -10,21 +16,6 @@
  */
 int debug=0;
 
-/*
- * local variable
- */
-// static FILE *file;
-static int eof = 0;
-static int nRow = 0;
-static int nBuffer = 0;
-static int lBuffer = 0;
-static int nTokenStart = 0;
-static int nTokenLength = 0;
-static int nTokenNextStart = 0;
-int lMaxBuffer = 1000;
-int parseError = 0;
-char *buffer;
-
 /*--------------------------------------------------------------------
  * dumpChar
  *
@@ -42,8 +33,7 @@ char dumpChar(char c) {
  * printable version of a string upto 100 character
  *------------------------------------------------------------------*/
 static
-char *dumpString(char *s) {
-  static char buf[101];
+char *dumpString(char *s, char *buf) {
   int i;
   int n = strlen(s);
 
@@ -55,14 +45,27 @@ char *dumpString(char *s) {
   buf[i] = 0;
   return buf;
 }
+/*--------------------------------------------------------------------
+ * rowLength
+ *
+ * length of a row without the line break
+ *------------------------------------------------------------------*/
+static
+long rowLength(SourceInput *in, int row) {
+  long start = in->lineStarts[row - 1];
+  long end = row < (int)in->lineStarts.size() ? in->lineStarts[row] : in->lBuffer;
+  if (  end > start  &&  in->buffer[end - 1] == '\n'  )
+    end -= 1;
+  return end - start;
+}
 /*--------------------------------------------------------------------
  * DumpRow
  *
  * dumps the contents of the current row
  *------------------------------------------------------------------*/
 extern
-void DumpRow(void) {
-  if (  nRow == 0  ) {
+void DumpRow(SourceInput *in) {
+  if (  in->nRow == 0  ) {
     int i;
     fprintf(stdout, "       |");
     for (i=1; i<71; i++)
@@ -74,8 +77,16 @@ void DumpRow(void) {
         fprintf(stdout, ".");
     fprintf(stdout, "\n");
   }
-  else
-    fprintf(stdout, "%6d |%.*s", nRow, lBuffer, buffer);
+  else {
+    long i;
+    long start = in->lineStarts[in->nRow - 1];
+    long length = rowLength(in, in->nRow);
+    fprintf(stdout, "%6d |", in->nRow);
+    /* flex keeps a NUL after the current token, the real char is on hold */
+    for (i=start; i<start + length; i++)
+      fputc(i == in->nTokenEnd ? in->cTokenHold : in->buffer[i], stdout);
+    fputc('\n', stdout);
+  }
 }
 /*--------------------------------------------------------------------
  * MarkToken
@@ -83,30 +94,22 @@ void DumpRow(void) {
  * marks the current read token
  *------------------------------------------------------------------*/
 extern
-void PrintError(const char *errorstring, ...) {
-  static char errmsg[10000];
+void PrintError(SourceInput *in, const char *errorstring, ...) {
+  char errmsg[10000];
   va_list args;
 
-  int start=nTokenStart;
-  int end=start + nTokenLength - 1;
+  int start=in->nTokenStart;
+  int end=start + in->nTokenLength - 1;
+  long length = in->nRow > 0 ? rowLength(in, in->nRow) : 0;
   int i;
 
-  /*================================================================*/
-  /* simple version ------------------------------------------------*/
-/*
-    fprintf(stdout, "...... !");
-    for (i=0; i<nBuffer; i++)
-      fprintf(stdout, ".");
-    fprintf(stdout, "^\n");
-*/
-
   /*================================================================*/
   /* a bit more complicate version ---------------------------------*/
 /* */
-  DumpRow();
-  if (  eof  ) {
+  DumpRow(in);
+  if (  in->eof  ) {
     fprintf(stdout, "...... !");
-    for (i=0; i<lBuffer; i++)
+    for (i=0; i<length; i++)
       fprintf(stdout, ".");
     fprintf(stdout, "^-EOF\n");
   }
@@ -116,7 +119,7 @@ void PrintError(const char *errorstring, ...) {
       fprintf(stdout, ".");
     for (i=start; i<=end; i++)
       fprintf(stdout, "^");
-    for (i=end+1; i<lBuffer; i++)
+    for (i=end+1; i<=length; i++)
       fprintf(stdout, ".");
     fprintf(stdout, "   token%d:%d\n", start, end);
   }
@@ -125,102 +128,160 @@ void PrintError(const char *errorstring, ...) {
   /*================================================================*/
   /* print it using variable arguments -----------------------------*/
   va_start(args, errorstring);
-  vsprintf(errmsg, errorstring, args);
+  vsnprintf(errmsg, sizeof(errmsg), errorstring, args);
   va_end(args);
 
   fprintf(stdout, "Error: %s\n", errmsg);
-  parseError = 1;
+  in->parseError = 1;
+}
+/*--------------------------------------------------------------------
+ * IndexLines
+ *
+ * line index of the buffer for the diagnostics
+ *------------------------------------------------------------------*/
+static
+void IndexLines(SourceInput *in) {
+  char *p;
+  in->lineStarts.clear();
+  in->lineStarts.push_back(0);
+  for (p = in->buffer; (p = (char *)memchr(p, '\n', in->buffer + in->lBuffer - p)); p++)
+    in->lineStarts.push_back(p - in->buffer + 1);
 }
 /*--------------------------------------------------------------------
- * getNextLine
+ * ReadSource
  *
- * reads a line into the buffer
+ * reads the whole input into the buffer, followed by the two NUL
+ * bytes flex needs to scan it in place, and indexes the line starts
  *------------------------------------------------------------------*/
 extern
-int getNextLine(void) {
-  int i;
+int ReadSource(SourceInput *in, FILE *f) {
+  struct stat st;
+  long pageSize = sysconf(_SC_PAGESIZE);
+  long capacity;
+  size_t n;
   char *p;
+  char *&buffer = in->buffer;
+  long &lBuffer = in->lBuffer;
 
   /*================================================================*/
-  /*----------------------------------------------------------------*/
-  nBuffer = 0;
-  nTokenStart = -1;
-  nTokenNextStart = 1;
-  eof = false;
+  /* map regular files; the NUL bytes are the zero fill of the last */
+  /* page, so the file must end at least two bytes before a page ---*/
+  /* boundary; one ending right at a boundary has no fill at all ----*/
+  if (  fstat(fileno(f), &st) == 0  &&  S_ISREG(st.st_mode)
+        &&  st.st_size > 0  &&  st.st_size % pageSize != 0
+        &&  st.st_size % pageSize <= pageSize - 2  ) {
+    p = (char *)mmap(NULL, st.st_size + 2, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fileno(f), 0);
+    if (  p != MAP_FAILED  ) {
+      buffer = p;
+      lBuffer = st.st_size;
+      in->isMapped = 1;
+    }
+  }
 
   /*================================================================*/
-  /* read a line ---------------------------------------------------*/
-  p = fgets(buffer, lMaxBuffer, yyin);
-  if (  p == NULL  ) {
-    if (  ferror(yyin)  )
+  /* otherwise read it in large blocks ------------------------------*/
+  if (  !in->isMapped  ) {
+    capacity = 1 << 16;
+    lBuffer = 0;
+    buffer = (char *)malloc(capacity);
+    while (  buffer  ) {
+      /* keep room for at least one byte besides the two NULs --------*/
+      if (  capacity - lBuffer <= 2  ) {
+        capacity *= 2;
+        p = (char *)realloc(buffer, capacity);
+        if (  !p  )
+          free(buffer);
+        buffer = p;
+        continue;
+      }
+      n = fread(buffer + lBuffer, 1, capacity - lBuffer - 2, f);
+      lBuffer += n;
+      if (  n == 0  &&  (feof(f)  ||  ferror(f))  )
+        break;
+    }
+    if (  !buffer  ||  ferror(f)  )
       return -1;
-    eof = true;
-    return 1;
+    buffer[lBuffer] = 0;
+    buffer[lBuffer + 1] = 0;
   }
 
-  nRow += 1;
-  lBuffer = strlen(buffer);
-  //DumpRow();
-
-  /*================================================================*/
-  /* that's it -----------------------------------------------------*/
+  IndexLines(in);
   return 0;
 }
 /*--------------------------------------------------------------------
- * GetNextChar
+ * ReadSourceText
  *
- * reads a character from input for flex
+ * copies text into the buffer, e.g. an input line of the REPL
  *------------------------------------------------------------------*/
 extern
-int GetNextChar(char *b, int maxBuffer) {
-  int frc;
-
-  /*================================================================*/
-  /*----------------------------------------------------------------*/
-  if (  eof  )
-    return 0;
-
-  /*================================================================*/
-  /* read next line if at the end of the current -------------------*/
-  while (  nBuffer >= lBuffer  ) {
-    frc = getNextLine();
-    if (  frc != 0  )
-      return 0;
-    }
-
-  /*================================================================*/
-  /* ok, return character ------------------------------------------*/
-  b[0] = buffer[nBuffer];
-  nBuffer += 1;
-
-  if (  debug  )
-    printf("GetNextChar() => '%c'0x%02x at %d\n",
-                        dumpChar(b[0]), b[0], nBuffer);
-  return b[0]==0?0:1;
+int ReadSourceText(SourceInput *in, const char *text, long length) {
+  in->buffer = (char *)malloc(length + 2);
+  if (  !in->buffer  )
+    return -1;
+  memcpy(in->buffer, text, length);
+  in->buffer[length] = 0;
+  in->buffer[length + 1] = 0;
+  in->lBuffer = length;
+  in->isMapped = 0;
+  IndexLines(in);
+  return 0;
+}
+/*--------------------------------------------------------------------
+ * ReleaseSource
+ *
+ * frees the buffer read by ReadSource
+ *------------------------------------------------------------------*/
+extern
+void ReleaseSource(SourceInput *in) {
+  if (  in->isMapped  )
+    munmap(in->buffer, in->lBuffer + 2);
+  else
+    free(in->buffer);
+  in->buffer = NULL;
+  in->lBuffer = 0;
+  in->isMapped = 0;
+}
+/*--------------------------------------------------------------------
+ * MarkEndOfInput
+ *
+ * the scanner reached the end of the buffer
+ *------------------------------------------------------------------*/
+extern
+void MarkEndOfInput(SourceInput *in) {
+  in->eof = true;
+  in->nRow = in->lineStarts.size();
 }
 /*--------------------------------------------------------------------
  * BeginToken
  *
- * marks the beginning of a new token
+ * marks the beginning of a new token; t points into the buffer
  *------------------------------------------------------------------*/
 extern
-void BeginToken(char *t) {
+void BeginToken(SourceInput *in, YYLTYPE *loc, char *t, int length, char hold) {
+  long offset = t - in->buffer;
+  char buf[101];
+
   /*================================================================*/
   /* remember last read token --------------------------------------*/
-  nTokenStart = nTokenNextStart;
-  nTokenLength = strlen(t);
-  nTokenNextStart = nBuffer; // + 1;
+  in->nTokens += 1;
+  in->nRow = std::upper_bound(in->lineStarts.begin(), in->lineStarts.end(), offset)
+             - in->lineStarts.begin();
+  in->nTokenStart = offset - in->lineStarts[in->nRow - 1] + 1;
+  in->nTokenLength = length;
+  in->nTokenEnd = offset + length;
+  in->cTokenHold = hold;
 
   /*================================================================*/
   /* location for bison --------------------------------------------*/
-  yylloc.first_line = nRow;
-  yylloc.first_column = nTokenStart;
-  yylloc.last_line = nRow;
-  yylloc.last_column = nTokenStart + nTokenLength - 1;
+  loc->first_line = in->nRow;
+  loc->first_column = in->nTokenStart;
+  loc->last_line = in->nRow;
+  loc->last_column = in->nTokenStart + in->nTokenLength - 1;
 
   if (  debug  ) {
-    printf("Token '%s' at %d:%d next at %d\n", dumpString(t),
-                        yylloc.first_column,
-                        yylloc.last_column, nTokenNextStart);
+    printf("Token '%s' at %d:%d\n", dumpString(t, buf),
+                        loc->first_column,
+                        loc->last_column);
   }
-}
\ No newline at end of file
+}
@@ -17,22 +17,33 @@ https://developer.ibm.com/tutorials/l-flexbison/
 
 #include "parser.h"
 
-/* lex & bison external functions */
-extern int yylex(void);
-extern int yyparse(void);
-extern void yyerror(char*);
-extern FILE *yyin;
+#include <vector>
 
+/* source buffer and error state of one compilation, see CompilationSession */
+struct SourceInput
+{
+  char *buffer = nullptr;
+  long lBuffer = 0;
+  int isMapped = 0;
+  std::vector<long> lineStarts;
+  int eof = 0;
+  int nRow = 0;
+  int nTokenStart = 0;
+  int nTokenLength = 0;
+  long nTokenEnd = -1;
+  char cTokenHold = 0;
+  int parseError = 0;
+  int nTokens = 0;
+};
 
 /* external variables */
 extern int debugErrorParser;
-extern int lMaxBuffer;
-extern char *buffer;
-extern int parseError;
 
-extern int GetNextChar(char *b, int maxBuffer);
-extern void BeginToken(char*);
-extern void PrintError(const char *s, ...);
-extern int getNextLine(void);
+extern int ReadSource(SourceInput *in, FILE *f);
+extern int ReadSourceText(SourceInput *in, const char *text, long length);
+extern void ReleaseSource(SourceInput *in);
+extern void MarkEndOfInput(SourceInput *in);
+extern void BeginToken(SourceInput *in, YYLTYPE *loc, char *t, int length, char hold);
+extern void PrintError(SourceInput *in, const char *s, ...);
 
 #endif /* BISON_ERROR_H_ */
\ No newline at end of file
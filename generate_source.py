@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Writes a synthetic program to stress the compiler: functions of int and
+double locals with nested if and for statements, arithmetic expressions of
+a given depth, calls of the previous functions and string literals.
+
+    python3 generate_source.py [--functions N] [--statements N] [--depth N]
+                               [--nesting N] [--strings N] [--seed N] [-o file.t]
+
+The program type checks and compiles; it is not meant to be run.
+"""
+import argparse
+import random
+import sys
+
+WORDS = ["alpha", "beta", "gamma", "delta", "value", "result", "step", "sum", "count", "total"]
+
+
+class FunctionWriter:
+    def __init__(self, rng, args, index, callees):
+        self.rng = rng
+        self.args = args
+        self.index = index
+        self.callees = callees
+        self.lines = []
+        self.ints = ["a"]
+        self.doubles = ["b"]
+        self.counter = 0
+        self.strings = 0
+
+    def new_name(self, prefix):
+        self.counter += 1
+        return "%s%d" % (prefix, self.counter)
+
+    def expression(self, depth, is_double):
+        """arithmetic expression of at most depth nested operators"""
+        rng = self.rng
+        if depth <= 0 or rng.random() < 0.15:
+            variables = self.doubles if is_double else self.ints
+            if rng.random() < 0.3:
+                return "%.2f" % rng.uniform(0, 100) if is_double else str(rng.randint(1, 100))
+            return rng.choice(variables)
+        if self.callees and not is_double and rng.random() < 0.1:
+            callee = rng.choice(self.callees)
+            return "%s(%s, %s)" % (callee, self.expression(depth - 1, False), self.expression(depth - 1, True))
+        operator = rng.choice(["+", "-", "*", "+", "-"] + (["/"] if is_double else []))
+        return "(%s %s %s)" % (self.expression(depth - 1, is_double), operator,
+                               self.expression(depth - 1, is_double))
+
+    def condition(self):
+        operator = self.rng.choice(["<", ">", "<=", ">=", "==", "!="])
+        return "%s %s %s" % (self.rng.choice(self.ints), operator, self.expression(1, False))
+
+    def emit(self, indent, text):
+        self.lines.append("  " * indent + text)
+
+    def statement(self, indent, nesting, count):
+        rng = self.rng
+        depth = self.args.depth
+        choice = rng.random()
+        if nesting > 0 and choice < 0.15:
+            self.emit(indent, "if (%s) {" % self.condition())
+            self.block(indent + 1, nesting - 1, count)
+            if rng.random() < 0.5:
+                self.emit(indent, "} else {")
+                self.block(indent + 1, nesting - 1, count)
+            self.emit(indent, "}")
+        elif nesting > 0 and choice < 0.3:
+            counter = self.new_name("i")
+            self.emit(indent, "int %s;" % counter)
+            self.emit(indent, "for (%s = 0; %s < %d; %s = %s + 1) {" % (
+                counter, counter, rng.randint(2, 100), counter, counter))
+            self.ints.append(counter)
+            self.block(indent + 1, nesting - 1, count)
+            self.ints.remove(counter)
+            self.emit(indent, "}")
+        elif self.strings < self.args.strings and choice < 0.4:
+            self.strings += 1
+            words = " ".join(rng.choice(WORDS) for _ in range(rng.randint(1, 4)))
+            if rng.random() < 0.5:
+                self.emit(indent, 'println("%s %%d", %s);' % (words, rng.choice(self.ints)))
+            else:
+                self.emit(indent, 'println("%s %%f", %s);' % (words, rng.choice(self.doubles)))
+        elif choice < 0.7:
+            is_double = rng.random() < 0.5
+            name = self.new_name("d" if is_double else "n")
+            self.emit(indent, "%s %s = %s;" % ("double" if is_double else "int", name,
+                                              self.expression(depth, is_double)))
+            # visible until the end of the enclosing block
+            (self.doubles if is_double else self.ints).append(name)
+        else:
+            is_double = rng.random() < 0.5
+            target = rng.choice(self.doubles if is_double else self.ints)
+            self.emit(indent, "%s = %s;" % (target, self.expression(depth, is_double)))
+
+    def block(self, indent, nesting, count):
+        """a nested block has a quarter of the statements of the outer one"""
+        scope = (len(self.ints), len(self.doubles))
+        count = max(1, count // 4)
+        for _ in range(count):
+            self.statement(indent, nesting, count)
+        del self.ints[scope[0]:]
+        del self.doubles[scope[1]:]
+
+    def write(self):
+        name = "f%d" % self.index
+        self.emit(0, "int %s(int a, double b) {" % name)
+        for _ in range(self.args.statements):
+            self.statement(1, self.args.nesting, self.args.statements)
+        self.emit(1, "return %s;" % self.expression(self.args.depth, False))
+        self.emit(0, "}")
+        return name
+
+
+def generate(args, out):
+    rng = random.Random(args.seed)
+    callees = []
+    out.write("/* generated by generate_source.py --functions %d --statements %d --depth %d"
+              " --nesting %d --strings %d --seed %d */\n\n" % (
+                  args.functions, args.statements, args.depth, args.nesting, args.strings, args.seed))
+    for index in range(args.functions):
+        writer = FunctionWriter(rng, args, index, callees[-8:])
+        callees.append(writer.write())
+        out.write("\n".join(writer.lines))
+        out.write("\n\n")
+    for name in callees[-8:]:
+        out.write('println("%s = %%d", %s(1, 2.0));\n' % (name, name))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="synthetic source for compiler benchmarks")
+    parser.add_argument("--functions", type=int, default=100, help="number of functions")
+    parser.add_argument("--statements", type=int, default=20, help="statements per function body")
+    parser.add_argument("--depth", type=int, default=3, help="operators nested in an expression")
+    parser.add_argument("--nesting", type=int, default=2, help="if and for statements nested in each other")
+    parser.add_argument("--strings", type=int, default=2, help="string literals per function")
+    parser.add_argument("--seed", type=int, default=1, help="random seed, the same seed writes the same program")
+    parser.add_argument("-o", "--output", help="output file, stdout by default")
+    args = parser.parse_args()
+
+    if args.output:
+        with open(args.output, "w") as out:
+            generate(args, out)
+    else:
+        generate(args, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,9 +1,17 @@
 #include <iostream>
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <locale>
+#include <sys/resource.h>
+#include <unistd.h>
 #include "AST.h"
 #include "codegen.h"
 #include "error.h"
+#include "session.h"
+#include "driver.h"
+#include "repl.h"
+#include "server.h"
 #include "external/clipp.h"
 using namespace clipp;
 
@@ -13,25 +21,69 @@ using namespace clipp;
 #define PATH_SEPARATOR "/"
 #endif
 
-extern BlockExprAST *programBlock;
-extern FunctionMap *definedFunctions;
-
-extern FILE *yyin;
-extern int yyparse();
-
 int main(int argc, char *argv[])
 {
   std::locale::global(std::locale("en_US.UTF-8"));
   // command line arguments
+  std::vector<std::string> optInputFiles;
   std::string optInputFile = "", optOutputFile = "";
-  bool isOptEmitLLVM = false, isOptInteractive = false;
+  bool isOptEmitLLVM = false, isOptInteractive = false, isOptLazy = false, isOptRepl = false;
+  unsigned optLevel = 2;
+  bool isOptNativeArch = false;
+  std::string optCPU = "", optFeatures = "";
+  bool isOptProfileGenerate = false;
+  std::string optProfileUse = "";
+  bool isOptNoBoundsCheck = false;
+  bool isOptTimeReport = false, isOptStats = false;
+  std::string optStatsJSON = "";
+  std::string optCodegenThreads = "";
+  std::string optJITCache = "", optJITCacheSize = "";
+  std::string optServer = "", optConnect = "";
+  bool isOptJobs = false;
+  unsigned optJobs = 0;
+  unsigned optThreads = 0;
   std::string objectFile, llvmFile;
 
   auto cli = (
-    opt_value("input file", optInputFile),
+    opt_values(match::prefix_not("-"), "input files", optInputFiles),
     option("-emit-llvm").set(isOptEmitLLVM).doc("emit llvm code"),
     option("-i").set(isOptInteractive).doc("run interactive"),
+    option("-repl").set(isOptRepl).doc("prompt for statements and functions, each run as it is entered"),
+    option("-lazy").set(isOptLazy).doc("with -i, compile each function on its first call"),
+    (option("-O0").set(optLevel, 0u).doc("disable optimizations") |
+     option("-O1").set(optLevel, 1u).doc("optimize without vectorization and unrolling") |
+     option("-O2").set(optLevel, 2u).doc("default optimization level") |
+     option("-O3").set(optLevel, 3u).doc("aggressive optimization")),
+    option("-march=native").set(isOptNativeArch).doc("tune for the host CPU and its features"),
+    opt_value(match::prefix("-mcpu="), "-mcpu=<name>", optCPU).doc("target CPU"),
+    opt_value(match::prefix("-mattr="), "-mattr=<features>", optFeatures)
+      .doc("target features, e.g. +avx2,+fma"),
+    option("-fprofile-generate").set(isOptProfileGenerate)
+      .doc("instrument the program; counters are written to default.prof"),
+    opt_value(match::prefix("-fprofile-use="), "-fprofile-use=<file>", optProfileUse)
+      .doc("optimize using a profile from an instrumented run"),
+    option("-fno-bounds-check").set(isOptNoBoundsCheck)
+      .doc("do not check array indexes against the array length"),
+    opt_value(match::prefix("-fcodegen-threads="), "-fcodegen-threads=<n>", optCodegenThreads)
+      .doc("split the backend of large programs over <n> threads, 0 for one per core"),
+    opt_value(match::prefix("-fjit-cache="), "-fjit-cache=<dir>", optJITCache)
+      .doc("with -i, reuse objects of unchanged code from <dir>"),
+    opt_value(match::prefix("-fjit-cache-size="), "-fjit-cache-size=<MB>", optJITCacheSize)
+      .doc("size limit of the JIT cache, default 512"),
+    option("-ftime-report").set(isOptTimeReport).doc("print the time of each compile phase and pass"),
+    option("-stats").set(isOptStats).doc("print AST, IR, memory, lexer and JIT cache statistics"),
+    opt_value(match::prefix("-stats-json="), "-stats-json=<file>", optStatsJSON)
+      .doc("write the statistics and the phase times to <file> as JSON"),
+    opt_value(match::prefix("-server="), "-server=<socket>", optServer)
+      .doc("run as a compile server on a Unix socket"),
+    opt_value(match::prefix("-connect="), "-connect=<socket>", optConnect)
+      .doc("compile or run (-i) on the compile server listening on <socket>"),
+    (option("-threads") & value("threads", optThreads))
+      .doc("run parallel for loops on <threads> threads, 0 for one per core"),
+    (option("-j").set(isOptJobs) & value("jobs", optJobs))
+      .doc("compile the input files on <jobs> threads, 0 for one per core"),
     option("-o") & value("output file", optOutputFile)
+      .doc("output file, or the object directory when compiling several files")
   );
 
   if (!parse(argc, argv, cli))
@@ -40,9 +92,65 @@ int main(int argc, char *argv[])
     return 0;
   }
 
+  // strip the "-mcpu=" and "-mattr=" prefixes
+  if (!optCPU.empty())
+    optCPU = optCPU.substr(optCPU.find('=') + 1);
+  if (!optFeatures.empty())
+    optFeatures = optFeatures.substr(optFeatures.find('=') + 1);
+  if (isOptNativeArch)
+    optCPU = "native";
+  if (!optProfileUse.empty())
+    optProfileUse = optProfileUse.substr(optProfileUse.find('=') + 1);
+  if (!optJITCache.empty())
+    optJITCache = optJITCache.substr(optJITCache.find('=') + 1);
+  if (!optStatsJSON.empty())
+    optStatsJSON = optStatsJSON.substr(optStatsJSON.find('=') + 1);
+  uint64_t jitCacheSize = 512;
+  if (!optJITCacheSize.empty())
+    jitCacheSize = std::strtoull(optJITCacheSize.c_str() + optJITCacheSize.find('=') + 1, nullptr, 10);
+  unsigned codegenThreads = 1;
+  if (!optCodegenThreads.empty())
+    codegenThreads = std::strtoul(optCodegenThreads.c_str() + optCodegenThreads.find('=') + 1, nullptr, 10);
+
+  if (!optServer.empty())
+    return runServer(optServer.substr(optServer.find('=') + 1));
+
+  // several files, a directory or -j build one object per file
+  std::vector<std::string> inputFiles = expandInputs(optInputFiles);
+  if (isOptJobs || inputFiles.size() > 1 || inputFiles != optInputFiles)
+  {
+    if (isOptInteractive || isOptEmitLLVM)
+    {
+      std::cout << "Error: -i and -emit-llvm take a single input file" << std::endl;
+      return 1;
+    }
+    // the phase timers are shared by all sessions, the workers would run them at once
+    if (isOptTimeReport || !optStatsJSON.empty())
+    {
+      std::cout << "Error: -ftime-report and -stats-json take a single input file" << std::endl;
+      return 1;
+    }
+    BuildOptions build;
+    build.OptLevel = optLevel;
+    build.CPU = optCPU;
+    build.Features = optFeatures;
+    build.OutputDir = optOutputFile;
+    build.Jobs = optJobs;
+    build.CodegenThreads = codegenThreads;
+    build.BoundsChecks = !isOptNoBoundsCheck;
+    build.ParallelThreads = optThreads;
+    build.ProfileGenerate = isOptProfileGenerate;
+    build.ProfileUse = optProfileUse;
+    build.Stats = isOptStats;
+    return buildFiles(inputFiles, build) ? 1 : 0;
+  }
+  if (!inputFiles.empty())
+    optInputFile = inputFiles[0];
+
+  FILE *input;
   if (optInputFile.empty())
-    yyin = stdin;
-  else if (!(yyin = fopen(optInputFile.c_str(), "rt")))
+    input = stdin;
+  else if (!(input = fopen(optInputFile.c_str(), "rt")))
   {
     std::cout << "Error: can not open file " << optInputFile << std::endl;
     return 1;
@@ -60,37 +168,140 @@ int main(int argc, char *argv[])
 
   llvmFile = !optOutputFile.empty() ? optOutputFile : baseFileName + ".ll";
 
+  if (!optConnect.empty())
+  {
+    ServerRequest request;
+    request.Command = isOptEmitLLVM ? "emit-llvm" : isOptInteractive ? "run" : "compile";
+    request.OptLevel = optLevel;
+    request.CPU = optCPU;
+    request.Features = optFeatures;
+    request.Name = optInputFile;
+    request.BoundsChecks = !isOptNoBoundsCheck;
+    request.ParallelThreads = optThreads;
+    request.CodegenThreads = codegenThreads;
+    request.Lazy = isOptLazy;
+    request.ProfileGenerate = isOptProfileGenerate;
+    request.ProfileFile = std::filesystem::absolute("default.prof").string();
+    if (!optProfileUse.empty())
+      request.ProfileUse = std::filesystem::absolute(optProfileUse).string();
+    if (!optJITCache.empty())
+      request.JITCache = std::filesystem::absolute(optJITCache).string();
+    request.JITCacheSize = jitCacheSize << 20;
+    char block[1 << 16];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), input)) > 0)
+      request.Source.append(block, n);
+    // a program run by the server reads the client's stdin, if the source did not come from it
+    if (request.Command == "run" && input != stdin && !isatty(STDIN_FILENO))
+      while ((n = fread(block, 1, sizeof(block), stdin)) > 0)
+        request.Input.append(block, n);
+    return runClient(optConnect.substr(optConnect.find('=') + 1), request,
+                     isOptEmitLLVM ? llvmFile : objectFile);
+  }
+
+  // pass timing is enabled before the pass managers are created
+  TimePassesIsEnabled = isOptTimeReport || !optStatsJSON.empty();
+
   // parse
-  Codegen context;
+  CompilationSession session(optCPU, optFeatures);
+  Codegen &context = session.Context;
+  context.setOptimizationLevel(optLevel);
+  context.setProfileGenerate(isOptProfileGenerate);
+  context.setCodegenThreads(codegenThreads);
+  context.setBoundsChecks(!isOptNoBoundsCheck);
+  context.setParallelThreads(optThreads);
+  context.setLazyCompilation(isOptLazy && isOptInteractive && !isOptEmitLLVM);
+  if (!optJITCache.empty() && isOptInteractive)
+    context.setJITCache(optJITCache, jitCacheSize << 20);
+  if (!optProfileUse.empty() && !context.loadProfile(optProfileUse))
+    return 1;
 
-  buffer = (char *)malloc(lMaxBuffer);
-  while (getNextLine() == 0 && !parseError)
-    yyparse();
+  if (isOptRepl)
+  {
+    // the REPL has no main function to start the thread pool
+    __parallel_init(optThreads);
+    return runRepl(session);
+  }
 
-  if (!programBlock || parseError)
+  bool isParsePassed;
+  auto parseStart = std::chrono::steady_clock::now();
   {
-    // no message here as printError() function will print the parser errors
-    return 2;
+    NamedRegionTimer timer("parse", "Parsing", PhaseTimerGroup, PhaseTimerGroupDesc,
+      TimePassesIsEnabled);
+    if (!session.readSource(input))
+    {
+      std::cout << "Error: can not read " << (optInputFile.empty() ? "stdin" : optInputFile) << std::endl;
+      return 1;
+    }
+    isParsePassed = session.parse();
   }
+  std::chrono::duration<double> parseTime = std::chrono::steady_clock::now() - parseStart;
+
+  if (!isParsePassed)
+    return 2;
 
-  context.setFunctionList(definedFunctions);
+  BlockExprAST *programBlock = session.ProgramBlock;
 
-  if (context.typeCheck(*programBlock))
-    context.generateCode(*programBlock, false, isOptEmitLLVM, llvmFile);
-  else
+  bool isTypeCheckPassed;
+  {
+    NamedRegionTimer timer("typecheck", "Type checking", PhaseTimerGroup, PhaseTimerGroupDesc,
+      TimePassesIsEnabled);
+    isTypeCheckPassed = context.typeCheck(*programBlock);
+  }
+  if (!isTypeCheckPassed)
   {
     std::cout << "Type errors found. Can not run code." << std::endl;
     return 1;
   }
 
-  if (isOptEmitLLVM)
-    return 0;
+  /* writeObjFile generates its own module, the JIT module is only built
+     to be run or printed */
+  if (isOptInteractive || isOptEmitLLVM)
+    context.generateCode(*programBlock, true, isOptEmitLLVM, llvmFile);
 
-  if (isOptInteractive)
+  if (isOptInteractive && !isOptEmitLLVM)
     context.runCode(optInputFile);
-  else
-    context.writeObjFile(*programBlock, objectFile);
+  else if (!isOptEmitLLVM && !context.writeObjFile(*programBlock, objectFile))
+    return 1; /* writeObjFile reports why */
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  int nTokens = session.Input.nTokens;
+
+  /* written before -ftime-report, printing the timers resets them */
+  if (!optStatsJSON.empty())
+  {
+    std::error_code EC;
+    raw_fd_ostream os(optStatsJSON, EC, sys::fs::OF_Text);
+    if (EC)
+    {
+      std::cout << "Error: can not write " << optStatsJSON << ": " << EC.message() << std::endl;
+      return 1;
+    }
+    os << "{\n"
+       << "\t\"source_bytes\": " << session.Input.lBuffer << ",\n"
+       << "\t\"source_lines\": " << session.Input.lineStarts.size() << ",\n"
+       << "\t\"tokens\": " << nTokens << ",\n"
+       << "\t\"ast_nodes\": " << session.Arena.size() << ",\n"
+       << "\t\"functions\": " << session.DefinedFunctions.size() << ",\n"
+       << "\t\"ir_instructions\": " << context.getInstructionCount() << ",\n"
+       << "\t\"peak_rss_kb\": " << usage.ru_maxrss;
+    TimerGroup::printAllJSONValues(os, ",\n");
+    os << "\n}\n";
+  }
+
+  if (isOptTimeReport)
+    TimerGroup::printAll(errs());
+
+  if (isOptStats)
+  {
+    errs() << "AST nodes: " << session.Arena.size() << "\n"
+           << "Functions: " << session.DefinedFunctions.size() << "\n";
+    context.printStatistics(errs());
+    errs() << "Tokens: " << nTokens << " in " << parseTime.count() << " s ("
+           << (parseTime.count() > 0 ? nTokens / parseTime.count() : 0) << " tokens/s)\n"
+           << "Peak RSS: " << usage.ru_maxrss << " KB\n";
+  }
 
-  free(buffer);
   return 0;
 }
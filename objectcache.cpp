@@ -0,0 +1,99 @@
+#include "objectcache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+/* objects of another build of the compiler are never reused */
+static const char *CompilerVersion = "LLVM " LLVM_VERSION_STRING ", built " __DATE__ " " __TIME__;
+
+DiskObjectCache::DiskObjectCache(const std::string &Directory, uint64_t MaxSizeBytes,
+                                 const std::string &CPU, const std::string &Features)
+  : Directory(Directory)
+{
+  TargetKey = CPU + "\n" + Features + "\n" + CompilerVersion;
+  sys::fs::create_directories(Directory);
+
+  // prune on every run, by size and after a week without use
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.MaxSizeBytes = MaxSizeBytes;
+}
+
+DiskObjectCache::~DiskObjectCache()
+{
+  if (Misses > 0)
+    pruneCache(Directory, Policy);
+}
+
+/* the triple and data layout are part of the module */
+std::string DiskObjectCache::keyOf(const Module *M)
+{
+  SmallString<0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(*M, OS);
+
+  SHA1 Hasher;
+  Hasher.update(TargetKey);
+  Hasher.update(Bitcode);
+  return toHex(Hasher.result());
+}
+
+/* pruneCache only considers files with the llvmcache- prefix */
+std::string DiskObjectCache::pathOf(const std::string &Key)
+{
+  SmallString<128> Path(Directory);
+  sys::path::append(Path, "llvmcache-" + Key + ".o");
+  return std::string(Path);
+}
+
+std::unique_ptr<MemoryBuffer> DiskObjectCache::getObject(const Module *M)
+{
+  std::string Key = keyOf(M);
+  std::string Path = pathOf(Key);
+  auto Object = MemoryBuffer::getFile(Path, /*IsText*/ false, /*RequiresNullTerminator*/ false);
+  if (Object)
+  {
+    Hits++;
+    // the access time orders the eviction
+    int FD;
+    if (!sys::fs::openFileForWrite(Path, FD, sys::fs::CD_OpenExisting, sys::fs::OF_Append))
+    {
+      sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+      sys::Process::SafelyCloseFileDescriptor(FD);
+    }
+    return std::move(*Object);
+  }
+
+  Misses++;
+  std::lock_guard<std::mutex> Guard(Lock);
+  PendingKeys[M] = Key;
+  return nullptr;
+}
+
+void DiskObjectCache::notifyObjectCompiled(const Module *M, MemoryBufferRef Obj)
+{
+  std::string Key;
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    auto It = PendingKeys.find(M);
+    if (It == PendingKeys.end())
+      return;
+    Key = std::move(It->second);
+    PendingKeys.erase(It);
+  }
+
+  // written to a temporary file and renamed, other processes may read the cache
+  Error Err = writeToOutput(pathOf(Key), [&](raw_ostream &OS) {
+    OS << Obj.getBuffer();
+    return Error::success();
+  });
+  if (Err)
+    errs() << "Could not write the JIT cache: " << toString(std::move(Err)) << "\n";
+}
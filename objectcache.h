@@ -0,0 +1,44 @@
+/* Persistent cache of JIT compiled objects, see -fjit-cache. Objects are
+   keyed by a hash of the optimized module, the target CPU and features and
+   the compiler version, so an unchanged program skips the backend on the
+   next run. The directory is pruned to a size limit, least recently used
+   objects first. */
+#ifndef OBJECT_CACHE_H_
+#define OBJECT_CACHE_H_
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+class DiskObjectCache : public llvm::ObjectCache
+{
+  std::string Directory;
+  std::string TargetKey;
+  llvm::CachePruningPolicy Policy;
+
+  /* keys of the modules between getObject and notifyObjectCompiled;
+     the JIT compiles on several threads */
+  std::mutex Lock;
+  std::map<const llvm::Module *, std::string> PendingKeys;
+
+  std::string keyOf(const llvm::Module *M);
+  std::string pathOf(const std::string &Key);
+
+public:
+  std::atomic<unsigned> Hits{0};
+  std::atomic<unsigned> Misses{0};
+
+  DiskObjectCache(const std::string &Directory, uint64_t MaxSizeBytes,
+                  const std::string &CPU, const std::string &Features);
+  ~DiskObjectCache();
+
+  void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+};
+
+#endif /* OBJECT_CACHE_H_ */
@@ -1,22 +1,36 @@
 %define parse.error detailed
+%define api.pure full
+%code requires {
+  /* the scanner handle of tokens.l, see %option reentrant */
+  #ifndef YY_TYPEDEF_YY_SCANNER_T
+  #define YY_TYPEDEF_YY_SCANNER_T
+  typedef void *yyscan_t;
+  #endif
+  class CompilationSession;
+}
 %{
   #include <cstdio>
   #include <algorithm>
+  #include <charconv>
   #include <map>
   #include <string>
   #include "AST.h"
-  #include "error.h"
-
-  BlockExprAST *programBlock;
-  FunctionMap *definedFunctions = new FunctionMap();
-
-  extern void yyerror(const char *str) {
-    PrintError(str);
+  #include "codegen.h"
+  #include "session.h"
+
+  template <class T>
+  static T parseNumber(TokenText token) {
+    T value = 0;
+    std::from_chars(token.Data, token.Data + token.Length, value);
+    return value;
   }
 
 %}
 /* generate include-file with symbols and types for locations to work */
 %locations
+/* all parser state is on the stack or in the session being compiled */
+%param {yyscan_t scanner}
+%parse-param {CompilationSession &session}
 
 %union {
     IdentifierExprAST *ident;
@@ -28,32 +42,46 @@
     StatementAST *stmt;
     ReturnStatementAST *return_stmt;
     VarDeclExprAST *var_decl;
-    std::string *string;
+    ReductionList *reductions;
+    ReductionOp reduction_op;
+    TokenText text;
+    BinaryOp binop;
     int token;
 }
 
+%code {
+  extern int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
+
+  void yyerror(YYLTYPE *llocp, yyscan_t scanner, CompilationSession &session, const char *str) {
+    PrintError(&session.Input, str);
+  }
+}
+
 /* Define our terminal symbols (tokens). This should
    match our tokens.l lex file. We also define the node type
    they represent.
  */
-%token <string> IDENTIFIER INTEGER DOUBLE STRINGVAL
-%token <token> LPAREN RPAREN LBRACE TBRACE COMMA DOT SEMICOLON
-%token <string> EQ NE LT LE GT GE EQUAL
-%token <string> PLUS MINUS MUL DIV
-%token <string> RETURN IF ELSE FOR
+%token <text> IDENTIFIER INTEGER DOUBLE STRINGVAL
+%token <token> LPAREN RPAREN LBRACE TBRACE LBRACKET RBRACKET COMMA DOT COLON SEMICOLON
+%token <binop> EQ NE LT LE GT GE
+%token <binop> PLUS MINUS MUL DIV
+%token <token> EQUAL
+%token RETURN IF ELSE FOR TAILREC PARALLEL REDUCE
 
 /* Define the type of node our nonterminal symbols represent.
    The types refer to the %union declaration above. Ex: when
    we call an ident (defined by union type ident) we are really
    calling an (NIdentifier*). It makes the compiler happy.
  */
-%type <ident> ident
-%type <expr> numeric expr add_expr mul_expr comparison_expr factor call_expr string_val
+%type <ident> ident type_name
+%type <expr> numeric expr add_expr mul_expr comparison_expr factor call_expr string_val index_expr
 %type <block> program stmts block function_block
 %type <func_args> func_decl_args
 %type <expr_list> expr_list
-%type <stmt> stmt var_decl func_decl if_stmt loop_stmt for_stmt return_stmt
-%type <string> comparison_op add_op mul_op
+%type <stmt> stmt var_decl func_decl if_stmt loop_stmt for_stmt parallel_for_stmt return_stmt
+%type <reductions> reduction_list
+%type <reduction_op> reduction_op
+%type <binop> comparison_op add_op mul_op
 
 /* Operator precedence for mathematical operators */
 %left PLUS MINUS
@@ -65,78 +93,131 @@
 
 %%
 
-program : stmts { programBlock = $1; }
+program : stmts { session.ProgramBlock = $1; }
         ;
 
-stmts : stmt { $$ = new BlockExprAST(); $$->Statements.push_back($<stmt>1); }
+stmts : stmt { $$ = session.Arena.create<BlockExprAST>(); $$->Statements.push_back($<stmt>1); }
       | stmts stmt { $1->Statements.push_back($<stmt>2); }
       ;
 
 stmt : func_decl | if_stmt | loop_stmt
-     | expr SEMICOLON { $$ = new ExpressionStatementAST(*$1); }
+     | expr SEMICOLON { $$ = session.Arena.create<ExpressionStatementAST>(*$1); }
      | var_decl SEMICOLON
      ;
 
-return_stmt : RETURN expr SEMICOLON { $$ = new ReturnStatementAST($2); }
-     | RETURN SEMICOLON { $$ = new ReturnStatementAST(); }
+return_stmt : RETURN expr SEMICOLON { $$ = session.Arena.create<ReturnStatementAST>($2); }
+     | RETURN SEMICOLON { $$ = session.Arena.create<ReturnStatementAST>(); }
      ;
 
-var_decl : ident ident { $$ = new VarDeclExprAST(*$1, *$2); }
-         | ident ident EQUAL expr { $$ = new VarDeclExprAST(*$1, *$2, $4); }
+var_decl : type_name ident { $$ = session.Arena.create<VarDeclExprAST>(*$1, *$2); }
+         | type_name ident EQUAL expr { $$ = session.Arena.create<VarDeclExprAST>(*$1, *$2, $4); }
          ;
 
-ident : IDENTIFIER { $$ = new IdentifierExprAST(*$1); delete $1; }
+ident : IDENTIFIER { $$ = session.Arena.create<IdentifierExprAST>(session.Arena.save($1.view())); }
       ;
 
+/* int[] and double[] are the names "int[]" and "double[]", see Codegen::stringTypeToLLVM */
+type_name : ident
+          | ident LBRACKET RBRACKET
+            { $$ = session.Arena.create<IdentifierExprAST>(session.Arena.save(std::string($1->Name) + "[]")); }
+          ;
+
 string_val : STRINGVAL
           {
-            std::string str = *$1;
+            std::string str($1.view());
             str.erase(std::remove(str.begin(), str.end(), '"'), str.end());
-            $$ = new StringExprAST(str); delete $1;
+            $$ = session.Arena.create<StringExprAST>(str);
           };
 
-numeric : INTEGER { $$ = new IntExprAST(atoi($1->c_str())); delete $1; }
-        | DOUBLE  { $$ = new DoubleExprAST(std::stod($1->c_str())); delete $1;  }
+numeric : INTEGER { $$ = session.Arena.create<IntExprAST>(parseNumber<int>($1)); }
+        | DOUBLE  { $$ = session.Arena.create<DoubleExprAST>(parseNumber<double>($1)); }
         ;
 
-if_stmt : IF LPAREN expr RPAREN block { $$ = new IfStatementAST($3, $5); }
-        | IF LPAREN expr RPAREN block ELSE block { $$ = new IfStatementAST($3, $5, $7); }
-        | IF LPAREN expr RPAREN block ELSE if_stmt { $$ = new IfStatementAST($3, $5, $7); }
+if_stmt : IF LPAREN expr RPAREN block { $$ = session.Arena.create<IfStatementAST>($3, $5); }
+        | IF LPAREN expr RPAREN block ELSE block { $$ = session.Arena.create<IfStatementAST>($3, $5, $7); }
+        | IF LPAREN expr RPAREN block ELSE if_stmt
+          {
+            BlockExprAST *elseBlock = session.Arena.create<BlockExprAST>();
+            elseBlock->Statements.push_back($7);
+            $$ = session.Arena.create<IfStatementAST>($3, $5, elseBlock);
+          }
         ;
 
-loop_stmt : for_stmt;
+loop_stmt : for_stmt | parallel_for_stmt;
 
 for_stmt : FOR LPAREN expr_list SEMICOLON expr SEMICOLON expr_list RPAREN block
-            { $$ = new ForStatementAST(*$3, $5, *$7, $9); }
+            { $$ = session.Arena.create<ForStatementAST>(*$3, $5, *$7, $9); delete $3; delete $7; }
          ;
 
+parallel_for_stmt : PARALLEL FOR LPAREN expr_list SEMICOLON expr SEMICOLON expr_list RPAREN block
+                    {
+                      ReductionList reductions;
+                      $$ = session.Arena.create<ParallelForStatementAST>(*$4, $6, *$8, reductions, $10);
+                      delete $4; delete $8;
+                    }
+                  | PARALLEL FOR LPAREN expr_list SEMICOLON expr SEMICOLON expr_list RPAREN
+                    REDUCE LPAREN reduction_list RPAREN block
+                    {
+                      $$ = session.Arena.create<ParallelForStatementAST>(*$4, $6, *$8, *$12, $14);
+                      delete $4; delete $8; delete $12;
+                    }
+                  ;
+
+reduction_list : reduction_op COLON ident { $$ = new ReductionList(); $$->push_back({$1, $3}); }
+               | reduction_list COMMA reduction_op COLON ident { $1->push_back({$3, $5}); }
+               ;
+
+reduction_op : PLUS { $$ = ReductionOp::Sum; }
+             | ident
+               {
+                 if ($1->Name == "min")
+                   $$ = ReductionOp::Min;
+                 else if ($1->Name == "max")
+                   $$ = ReductionOp::Max;
+                 else
+                 {
+                   yyerror(&@1, scanner, session, "reductions are +, min and max");
+                   YYERROR;
+                 }
+               }
+             ;
+
 /* expressions */
 
 expr : comparison_expr | string_val
-     | ident EQUAL expr { $$ = new AssignmentAST(*$<ident>1, *$3); }
+     | ident EQUAL expr { $$ = session.Arena.create<AssignmentAST>(*$<ident>1, *$3); }
+     | index_expr EQUAL expr
+       { $$ = session.Arena.create<IndexAssignmentAST>(*static_cast<IndexExprAST *>($1), *$3); }
      ;
 
-comparison_expr : comparison_expr comparison_op add_expr { $$ = new BinaryExprAST(*$2, $1, $3); }
+comparison_expr : comparison_expr comparison_op add_expr { $$ = session.Arena.create<BinaryExprAST>($2, $1, $3); }
      | add_expr
      ;
 
-add_expr : add_expr add_op mul_expr { $$ = new BinaryExprAST(*$2, $1, $3); }
+add_expr : add_expr add_op mul_expr { $$ = session.Arena.create<BinaryExprAST>($2, $1, $3); }
          | mul_expr
          ;
 
-mul_expr : mul_expr mul_op factor { $$ = new BinaryExprAST(*$2, $1, $3); }
+mul_expr : mul_expr mul_op factor { $$ = session.Arena.create<BinaryExprAST>($2, $1, $3); }
          | factor;
 
 factor : LPAREN expr RPAREN { $$ = $2; }
        | ident { $<ident>$ = $1; }
+       | index_expr
+       | ident DOT ident { $$ = session.Arena.create<MemberExprAST>(*$1, *$3); }
        | call_expr
        | numeric /* MINUS factor too! But it needs a class to support unary expressions */
-       | MINUS factor { $$ = new UnaryExprAST(*$1, $2); }
+       | MINUS factor { $$ = session.Arena.create<UnaryExprAST>(UnaryOp::Neg, $2); }
        ;
 
-call_expr : ident LPAREN expr_list RPAREN { $$ = new CallExprAST(*$1, *$3); delete $3; }
+call_expr : ident LPAREN expr_list RPAREN { $$ = session.Arena.create<CallExprAST>(*$1, *$3); delete $3; }
+          | ident DOT ident LPAREN expr_list RPAREN
+            { $$ = session.Arena.create<MemberExprAST>(*$1, *$3, *$5); delete $5; }
           ;
 
+index_expr : ident LBRACKET expr RBRACKET { $$ = session.Arena.create<IndexExprAST>(*$1, *$3); }
+           ;
+
 comparison_op : EQ | NE | LT | LE | GT | GE ;
 
 add_op : PLUS | MINUS ;
@@ -145,21 +226,26 @@ mul_op : MUL | DIV ;
 
 /* function grammar rules */
 
-func_decl : ident ident LPAREN func_decl_args RPAREN function_block
+func_decl : type_name ident LPAREN func_decl_args RPAREN function_block
           {
-              FunctionDeclarationAST *fn = new FunctionDeclarationAST(*$1, *$2, *$4, *($<fnBlock>6));
+              FunctionDeclarationAST *fn = session.Arena.create<FunctionDeclarationAST>(*$1, *$2, *$4, *($<fnBlock>6));
               $$ = fn;
-              (*definedFunctions)[$2->Name] = fn;
+              session.DefinedFunctions[std::string($2->Name)] = fn;
               delete $4;
           }
+          | TAILREC func_decl
+          {
+              static_cast<FunctionDeclarationAST *>($2)->IsTailRecursive = true;
+              $$ = $2;
+          }
           ;
 
-function_block : LBRACE stmts return_stmt TBRACE { $<fnBlock>$ = new FunctionBlockAST($2, *$<return_stmt>3); }
-               | LBRACE return_stmt TBRACE { $<fnBlock>$ = new FunctionBlockAST(*$<return_stmt>2); }
+function_block : LBRACE stmts return_stmt TBRACE { $<fnBlock>$ = session.Arena.create<FunctionBlockAST>($2, *$<return_stmt>3); }
+               | LBRACE return_stmt TBRACE { $<fnBlock>$ = session.Arena.create<FunctionBlockAST>(*$<return_stmt>2); }
                ;
 
 block : LBRACE stmts TBRACE { $$ = $2; }
-      | LBRACE TBRACE { $$ = new BlockExprAST(); }
+      | LBRACE TBRACE { $$ = session.Arena.create<BlockExprAST>(); }
       | function_block { $$ = $1; }
       ;
 
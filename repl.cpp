@@ -0,0 +1,74 @@
+#include <iostream>
+#include <string>
+#include "AST.h"
+#include "codegen.h"
+#include "session.h"
+#include "repl.h"
+
+/* an input is complete when its braces and parentheses are closed and it
+   ends a statement or a block */
+static bool isComplete(const std::string &input)
+{
+  int depth = 0;
+  bool inString = false;
+  char last = 0;
+  for (size_t i = 0; i < input.size(); i++)
+  {
+    char c = input[i];
+    if (inString)
+    {
+      if (c == '\\')
+        i++;
+      else if (c == '"')
+        inString = false;
+      continue;
+    }
+    if (c == '/' && i + 1 < input.size() && input[i + 1] == '/')
+    {
+      i = input.find('\n', i);
+      if (i == std::string::npos)
+        break;
+      continue;
+    }
+    if (c == '"')
+      inString = true;
+    else if (c == '{' || c == '(')
+      depth++;
+    else if (c == '}' || c == ')')
+      depth--;
+    if (!isspace((unsigned char)c))
+      last = c;
+  }
+  return !inString && depth <= 0 && (last == ';' || last == '}');
+}
+
+int runRepl(CompilationSession &session)
+{
+  Codegen &context = session.Context;
+  context.beginRepl();
+
+  std::cout << "Enter statements and function definitions, Ctrl-D to exit." << std::endl;
+  std::string input, line;
+  std::cout << "> " << std::flush;
+  while (std::getline(std::cin, line))
+  {
+    input += line;
+    input += '\n';
+    if (!isComplete(input))
+    {
+      std::cout << ". " << std::flush;
+      continue;
+    }
+
+    // the nodes of every input stay in the session's arena, later inputs
+    // refer to the functions and variables declared by earlier ones
+    if (session.readSource(input) && session.parse())
+      for (StatementAST *statement : session.ProgramBlock->Statements)
+        if (!context.runReplStatement(*statement))
+          break;
+    input.clear();
+    std::cout << std::endl << "> " << std::flush;
+  }
+  std::cout << std::endl;
+  return 0;
+}
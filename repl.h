@@ -0,0 +1,11 @@
+/* Interactive prompt: every statement or function definition is compiled
+   and run when it is entered, on one JIT kept for the whole session. */
+#ifndef REPL_H_
+#define REPL_H_
+
+class CompilationSession;
+
+/* reads inputs from stdin until end of file; returns the exit status */
+int runRepl(CompilationSession &session);
+
+#endif /* REPL_H_ */
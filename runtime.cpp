@@ -2,22 +2,28 @@
 #include <cstdarg>
 #include <cstring>
 #include <cmath>
+#include <cerrno>
+#include <climits>
+#include <charconv>
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "runtime.h"
 /* Compile runtime.cpp separately when compiling to an object file */
 
 extern "C"
 {
-  int MAX_STRLEN = 1024;
-  char *inputbuf = 0;
-  void initialize() {
-    if (!inputbuf)
-      inputbuf = (char *)malloc(MAX_STRLEN * sizeof(char));
-    if (!inputbuf)
-    {
-      printf("Malloc failed!\n");
-      exit(1);
-    }
-  }
-
   /* MATH */
   double fabs(double X);
   double sqrt(double X);
@@ -28,22 +34,284 @@ extern "C"
   {
     return M_PI;
   }
+  /* OUTPUT: every thread formats into a buffer of its own, written to the
+     sink when full, by flush() and at exit. A full buffer is written up to
+     its last newline, so lines of different threads do not interleave. */
+  static const int OUTPUT_BUFSIZE = 1 << 16;
+  static const int OUTPUT_MAXNUMBER = 512; /* longer than %.100f of 1e308 */
+
+  struct OutputBuffer {
+    int length;
+    char data[OUTPUT_BUFSIZE];
+  };
+
+  static std::mutex outputLock; /* guards outputBuffers and the sink */
+  static std::vector<OutputBuffer *> *outputBuffers = 0;
+  static int outputFd = 1;
+  static thread_local OutputBuffer *threadOutput = 0;
+
+  /* the caller holds outputLock */
+  static bool writeSink(const char *data, int length) {
+    if (outputFd == 1)
+      fflush(stdout); /* whatever was printed through stdio comes first */
+    while (length > 0)
+    {
+      ssize_t written = write(outputFd, data, length);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written < 0)
+        return false;
+      data += written;
+      length -= written;
+    }
+    return true;
+  }
+
+  static bool writeOutput(OutputBuffer *out, int length) {
+    bool ok;
+    {
+      std::lock_guard<std::mutex> guard(outputLock);
+      ok = writeSink(out->data, length);
+    }
+    out->length -= length;
+    memmove(out->data, out->data + length, out->length);
+    return ok;
+  }
+
+  static void flushAllOutput() {
+    std::lock_guard<std::mutex> guard(outputLock);
+    for (OutputBuffer *out : *outputBuffers)
+    {
+      writeSink(out->data, out->length);
+      out->length = 0;
+    }
+  }
+
+  static OutputBuffer *output() {
+    if (threadOutput)
+      return threadOutput;
+    OutputBuffer *out = (OutputBuffer *)malloc(sizeof(OutputBuffer));
+    if (!out)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    out->length = 0;
+    std::lock_guard<std::mutex> guard(outputLock);
+    if (!outputBuffers)
+    {
+      outputBuffers = new std::vector<OutputBuffer *>();
+      atexit(flushAllOutput);
+    }
+    outputBuffers->push_back(out);
+    threadOutput = out;
+    return out;
+  }
+
+  /* called by a thread of the pool before it exits */
+  static void releaseOutput() {
+    OutputBuffer *out = threadOutput;
+    if (!out)
+      return;
+    std::lock_guard<std::mutex> guard(outputLock);
+    writeSink(out->data, out->length);
+    outputBuffers->erase(std::find(outputBuffers->begin(), outputBuffers->end(), out));
+    threadOutput = 0;
+    free(out);
+  }
+
+  /* room for n <= OUTPUT_BUFSIZE / 2 more characters */
+  static char *reserve(OutputBuffer *out, int n) {
+    if (OUTPUT_BUFSIZE - out->length >= n)
+      return out->data + out->length;
+    int length = out->length;
+    while (length > 0 && out->data[length - 1] != '\n')
+      length--;
+    if (OUTPUT_BUFSIZE - (out->length - length) < n)
+      length = out->length;
+    writeOutput(out, length);
+    return out->data + out->length;
+  }
+
+  static void append(OutputBuffer *out, const char *data, int length) {
+    while (length > 0)
+    {
+      int chunk = std::min(length, OUTPUT_BUFSIZE / 2);
+      memcpy(reserve(out, chunk), data, chunk);
+      out->length += chunk;
+      data += chunk;
+      length -= chunk;
+    }
+  }
+
+  /* %d %i %c %s, %f %e %g with an optional precision up to 100 and %% are
+     formatted here, other formats by vsnprintf */
+  static bool isFastFormat(const char *fmt) {
+    for (const char *p = fmt; (p = strchr(p, '%')); p++)
+    {
+      p++;
+      if (*p == '%')
+        continue;
+      bool hasPrecision = *p == '.';
+      if (hasPrecision)
+      {
+        int precision = 0;
+        for (p++; *p >= '0' && *p <= '9'; p++)
+          if ((precision = precision * 10 + *p - '0') > 100)
+            return false;
+      }
+      if (!*p || !strchr(hasPrecision ? "feg" : "dicsfeg", *p))
+        return false;
+    }
+    return true;
+  }
+
+  static int formatSlow(OutputBuffer *out, const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int space = OUTPUT_BUFSIZE - out->length;
+    int length = vsnprintf(out->data + out->length, space, fmt, copy);
+    va_end(copy);
+    if (length < 0)
+      return length;
+    if (length < space)
+    {
+      out->length += length;
+      return length;
+    }
+    char *text = (char *)malloc(length + 1);
+    if (!text)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    vsnprintf(text, length + 1, fmt, args);
+    append(out, text, length);
+    free(text);
+    return length;
+  }
+
+  static int format(OutputBuffer *out, const char *fmt, va_list args) {
+    if (!isFastFormat(fmt))
+      return formatSlow(out, fmt, args);
+    int written = 0;
+    for (const char *p = fmt; *p;)
+    {
+      const char *percent = strchr(p, '%');
+      int length = percent ? percent - p : strlen(p);
+      append(out, p, length);
+      written += length;
+      if (!percent)
+        break;
+      p = percent + 1;
+      int precision = 6;
+      if (*p == '.')
+        for (precision = 0, p++; *p >= '0' && *p <= '9'; p++)
+          precision = precision * 10 + *p - '0';
+      char conversion = *p++;
+      if (conversion == '%' || conversion == 's')
+      {
+        const char *text = conversion == '%' ? "%" : va_arg(args, const char *);
+        if (!text)
+          text = "(null)";
+        length = strlen(text);
+        append(out, text, length);
+        written += length;
+        continue;
+      }
+      char *first = reserve(out, OUTPUT_MAXNUMBER);
+      char *last = first + OUTPUT_MAXNUMBER;
+      char *end = first;
+      switch (conversion)
+      {
+      case 'c':
+        *end++ = (char)va_arg(args, int);
+        break;
+      case 'f':
+        end = std::to_chars(first, last, va_arg(args, double), std::chars_format::fixed, precision).ptr;
+        break;
+      case 'e':
+        end = std::to_chars(first, last, va_arg(args, double), std::chars_format::scientific, precision).ptr;
+        break;
+      case 'g':
+        end = std::to_chars(first, last, va_arg(args, double), std::chars_format::general, precision).ptr;
+        break;
+      default:
+        end = std::to_chars(first, last, va_arg(args, int)).ptr;
+      }
+      out->length += end - first;
+      written += end - first;
+    }
+    return written;
+  }
+
   /* IO */
+  int flush() {
+    OutputBuffer *out = output();
+    if (!out->length)
+      return 0;
+    return writeOutput(out, out->length) ? 0 : -1;
+  }
+
+  /* later output goes to the file at path, truncated; -1 if it cannot be opened */
+  int output_file(const char *path) {
+    flush();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return -1;
+    std::lock_guard<std::mutex> guard(outputLock);
+    if (outputFd != 1)
+      close(outputFd);
+    outputFd = fd;
+    return 0;
+  }
+
+  int output_stdout() {
+    flush();
+    std::lock_guard<std::mutex> guard(outputLock);
+    if (outputFd != 1)
+      close(outputFd);
+    outputFd = 1;
+    return 0;
+  }
+
   int printi(int X)
   {
-    return printf("%d\n", X);
+    OutputBuffer *out = output();
+    char *first = reserve(out, OUTPUT_MAXNUMBER);
+    char *end = std::to_chars(first, first + OUTPUT_MAXNUMBER, X).ptr;
+    *end++ = '\n';
+    out->length += end - first;
+    return end - first;
   }
 
+  /* %f, six decimals */
   int printd(double X)
   {
-    return printf("%f\n", X);
+    OutputBuffer *out = output();
+    char *first = reserve(out, OUTPUT_MAXNUMBER);
+    char *end = std::to_chars(first, first + OUTPUT_MAXNUMBER, X, std::chars_format::fixed, 6).ptr;
+    *end++ = '\n';
+    out->length += end - first;
+    return end - first;
+  }
+
+  /* the shortest text that reads back as X */
+  int printr(double X)
+  {
+    OutputBuffer *out = output();
+    char *first = reserve(out, OUTPUT_MAXNUMBER);
+    char *end = std::to_chars(first, first + OUTPUT_MAXNUMBER, X).ptr;
+    *end++ = '\n';
+    out->length += end - first;
+    return end - first;
   }
 
   int print(const char *fmt, ...) {
     int result = 0;
     va_list args;
     va_start(args, fmt);
-    result = vprintf(fmt, args);
+    result = format(output(), fmt, args);
     va_end(args);
     return result;
   }
@@ -52,32 +320,1390 @@ extern "C"
     int result = 0;
     va_list args;
     va_start(args, fmt);
-    result = vprintf(fmt, args);
+    OutputBuffer *out = output();
+    result = format(out, fmt, args);
+    append(out, "\n", 1);
     va_end(args);
-    putchar('\n');
-    return result;
+    return result < 0 ? result : result + 1;
+  }
+  /* INPUT: stdin is read in large blocks into one buffer, grown when a line
+     or a number does not fit, and numbers are parsed in place by from_chars.
+     Only one thread reads at a time. */
+  static const int INPUT_BUFSIZE = 1 << 20;
+  static char *inputBuf = 0;
+  static int inputSize = 0;
+  static int inputPos = 0;
+  static int inputEnd = 0;
+  static bool inputEof = false;
+
+  /* readline copies every line into blocks of LINE_BLOCKSIZE, freed at exit;
+     a string of the language is never freed by the program */
+  static const int LINE_BLOCKSIZE = 1 << 16;
+
+  struct LineBlock {
+    LineBlock *next;
+    int used;
+    int size;
+    char data[1];
+  };
+
+  static LineBlock *lineBlocks = 0;
+  static inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+  }
+
+  /* reads more of stdin after inputEnd, the unread text is moved to the
+     start of the buffer; false at the end of the input */
+  static bool fillInput() {
+    if (inputEof)
+      return false;
+    flush(); /* a prompt is out before the program waits for input */
+    memmove(inputBuf, inputBuf + inputPos, inputEnd - inputPos);
+    inputEnd -= inputPos;
+    inputPos = 0;
+    if (inputEnd == inputSize)
+    {
+      inputSize = inputSize ? 2 * inputSize : INPUT_BUFSIZE;
+      inputBuf = (char *)realloc(inputBuf, inputSize);
+      if (!inputBuf)
+      {
+        printf("Malloc failed!\n");
+        exit(1);
+      }
+    }
+    for (;;)
+    {
+      ssize_t length = read(0, inputBuf + inputEnd, inputSize - inputEnd);
+      if (length < 0 && errno == EINTR)
+        continue;
+      if (length <= 0)
+      {
+        inputEof = true;
+        return false;
+      }
+      inputEnd += length;
+      return true;
+    }
+  }
+
+  /* the end of the word at inputPos, after white space is skipped; -1 at
+     the end of the input */
+  static int nextWord() {
+    for (;;)
+    {
+      while (inputPos < inputEnd && isSpace(inputBuf[inputPos]))
+        inputPos++;
+      if (inputPos < inputEnd)
+        break;
+      if (!fillInput())
+        return -1;
+    }
+    int end = inputPos;
+    for (;;)
+    {
+      while (end < inputEnd && !isSpace(inputBuf[end]))
+        end++;
+      if (end < inputEnd)
+        return end;
+      int length = end - inputPos;
+      bool more = fillInput();
+      end = inputPos + length;
+      if (!more)
+        return end;
+    }
+  }
+
+  /* the end of the line at inputPos, after its newline */
+  static int nextLine() {
+    int end = inputPos;
+    for (;;)
+    {
+      char *newline = end < inputEnd ? (char *)memchr(inputBuf + end, '\n', inputEnd - end) : 0;
+      if (newline)
+        return newline + 1 - inputBuf;
+      int length = inputEnd - inputPos;
+      bool more = fillInput();
+      end = inputPos + length;
+      if (!more)
+        return end;
+    }
+  }
+
+  /* like atoi and atof, a number that does not parse is 0 */
+  static int parseInt(const char *first, const char *last) {
+    while (first < last && isSpace(*first))
+      first++;
+    if (first < last && *first == '+')
+      first++;
+    int x = 0;
+    if (std::from_chars(first, last, x).ec != std::errc())
+      return 0;
+    return x;
+  }
+
+  static double parseDouble(const char *first, const char *last) {
+    while (first < last && isSpace(*first))
+      first++;
+    if (first < last && *first == '+')
+      first++;
+    double x = 0;
+    if (std::from_chars(first, last, x).ec != std::errc())
+      return 0;
+    return x;
   }
+
+  static bool nextInt(int *x) {
+    int end = nextWord();
+    if (end < 0)
+      return false;
+    *x = parseInt(inputBuf + inputPos, inputBuf + end);
+    inputPos = end;
+    return true;
+  }
+
+  static bool nextDouble(double *x) {
+    int end = nextWord();
+    if (end < 0)
+      return false;
+    *x = parseDouble(inputBuf + inputPos, inputBuf + end);
+    inputPos = end;
+    return true;
+  }
+
+  /* readi, readd and readline consume a whole line */
   int readi() {
-    int x;
-    initialize();
-    fgets(inputbuf, MAX_STRLEN, stdin);
-    x = atoi(inputbuf);
+    int end = nextLine();
+    int x = parseInt(inputBuf + inputPos, inputBuf + end);
+    inputPos = end;
     return x;
   }
+
   double readd() {
-    double x;
-    initialize();
-    fgets(inputbuf, MAX_STRLEN, stdin);
-    x = atof(inputbuf);
+    int end = nextLine();
+    double x = parseDouble(inputBuf + inputPos, inputBuf + end);
+    inputPos = end;
     return x;
   }
+
+  static void freeLines() {
+    while (lineBlocks)
+    {
+      LineBlock *next = lineBlocks->next;
+      free(lineBlocks);
+      lineBlocks = next;
+    }
+  }
+
+  static char *allocateLine(int length) {
+    if (!lineBlocks || lineBlocks->size - lineBlocks->used < length)
+    {
+      if (!lineBlocks)
+        atexit(freeLines);
+      int size = std::max(length, LINE_BLOCKSIZE);
+      LineBlock *block = (LineBlock *)malloc(sizeof(LineBlock) + size);
+      if (!block)
+      {
+        printf("Malloc failed!\n");
+        exit(1);
+      }
+      block->next = lineBlocks;
+      block->used = 0;
+      block->size = size;
+      lineBlocks = block;
+    }
+    char *line = lineBlocks->data + lineBlocks->used;
+    lineBlocks->used += length;
+    return line;
+  }
+
+  /* the line with its newline, "" at the end of the input */
   char *readline() {
-    char *x;
-    initialize();
-    fgets(inputbuf, MAX_STRLEN, stdin);
-    int length = strlen(inputbuf);
-    x = (char *)malloc((strlen(inputbuf) + 1) * sizeof(char));
-    strncpy(x, inputbuf, length + 1);
+    int end = nextLine();
+    int length = end - inputPos;
+    char *line = allocateLine(length + 1);
+    memcpy(line, inputBuf + inputPos, length);
+    line[length] = 0;
+    inputPos = end;
+    return line;
+  }
+
+  /* whitespace separated numbers; 0 at the end of the input */
+  int next_int() {
+    int x = 0;
+    nextInt(&x);
+    return x;
+  }
+
+  double next_double() {
+    double x = 0;
+    nextDouble(&x);
+    return x;
+  }
+
+  /* 1 if another number follows before the end of the input */
+  int has_next() {
+    return nextWord() >= 0;
+  }
+
+  /* ARRAYS: allocated by int_array and double_array, grown by appends and
+     freed by the release of their last reference. The compiled code retains
+     an array for every variable that holds it and for every array a function
+     returns, see Codegen::createArrayStore; arrays are shared by the threads
+     of parallel for loops, so the count is atomic. */
+  static Array *newArray(int elemSize, int length) {
+    if (length < 0)
+      length = 0;
+    Array *array = (Array *)malloc(sizeof(Array));
+    void *buf = calloc(length ? length : 1, elemSize);
+    if (!array || !buf)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    array->refCount = 1;
+    array->elemSize = elemSize;
+    array->length = length;
+    array->maxLength = length ? length : 1;
+    array->buf = buf;
+    return array;
+  }
+
+  void __array_retain(Array *array) {
+    if (array)
+      __atomic_add_fetch(&array->refCount, 1, __ATOMIC_RELAXED);
+  }
+
+  void __array_release(Array *array) {
+    if (array && __atomic_sub_fetch(&array->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      free(array->buf);
+      free(array);
+    }
+  }
+
+  Array *int_array(int length) {
+    return newArray(sizeof(int), length);
+  }
+
+  Array *double_array(int length) {
+    return newArray(sizeof(double), length);
+  }
+
+  /* called by an append to a full array; doubling keeps appends amortized O(1) */
+  void __array_grow(Array *array) {
+    int maxLength = array->maxLength * 2;
+    void *buf = realloc(array->buf, (size_t)maxLength * array->elemSize);
+    if (!buf)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    array->buf = buf;
+    array->maxLength = maxLength;
+  }
+
+  void __array_bounds(int index, int length) {
+    flush();
+    fprintf(stderr, "Index %d is out of bounds of an array of length %d\n", index, length);
+    exit(1);
+  }
+
+  /* BULK INPUT: read_ints and read_doubles fill the array from the start
+     and return how many numbers were read, less than its length at the end
+     of the input; read_all_ints and read_all_doubles read up to the end */
+  int read_ints(Array *array) {
+    int *elements = (int *)array->buf;
+    int count = 0;
+    while (count < array->length && nextInt(&elements[count]))
+      count++;
+    return count;
+  }
+
+  int read_doubles(Array *array) {
+    double *elements = (double *)array->buf;
+    int count = 0;
+    while (count < array->length && nextDouble(&elements[count]))
+      count++;
+    return count;
+  }
+
+  Array *read_all_ints() {
+    Array *array = newArray(sizeof(int), 0);
+    int x;
+    while (nextInt(&x))
+    {
+      if (array->length == array->maxLength)
+        __array_grow(array);
+      ((int *)array->buf)[array->length++] = x;
+    }
+    return array;
+  }
+
+  Array *read_all_doubles() {
+    Array *array = newArray(sizeof(double), 0);
+    double x;
+    while (nextDouble(&x))
+    {
+      if (array->length == array->maxLength)
+        __array_grow(array);
+      ((double *)array->buf)[array->length++] = x;
+    }
+    return array;
+  }
+
+  /* VECTOR KERNELS on double[]: each kernel has a scalar version and AVX2 and
+     AVX-512 versions, picked once from the CPU features on the first call.
+     The vector reductions add in a different order than a loop would. */
+  typedef struct {
+    double (*sum)(const double *x, int n);
+    double (*dot)(const double *x, const double *y, int n);
+    void (*axpy)(double a, const double *x, double *y, int n);
+    void (*scale)(double *x, double a, int n);
+    double (*min)(const double *x, int n);
+    double (*max)(const double *x, int n);
+    void (*prefixSum)(double *x, int n);
+    void (*sin)(double *x, int n);
+    void (*cos)(double *x, int n);
+    void (*sqrt)(double *x, int n);
+  } VectorKernels;
+
+  static double sumScalar(const double *x, int n) {
+    double s = 0.0;
+    for (int i = 0; i < n; i++)
+      s += x[i];
+    return s;
+  }
+
+  static double dotScalar(const double *x, const double *y, int n) {
+    double s = 0.0;
+    for (int i = 0; i < n; i++)
+      s += x[i] * y[i];
+    return s;
+  }
+
+  static void axpyScalar(double a, const double *x, double *y, int n) {
+    for (int i = 0; i < n; i++)
+      y[i] += a * x[i];
+  }
+
+  static void scaleScalar(double *x, double a, int n) {
+    for (int i = 0; i < n; i++)
+      x[i] *= a;
+  }
+
+  static double minScalar(const double *x, int n) {
+    double m = INFINITY;
+    for (int i = 0; i < n; i++)
+      m = x[i] < m ? x[i] : m;
+    return m;
+  }
+
+  static double maxScalar(const double *x, int n) {
+    double m = -INFINITY;
+    for (int i = 0; i < n; i++)
+      m = x[i] > m ? x[i] : m;
+    return m;
+  }
+
+  static void prefixSumScalar(double *x, int n) {
+    for (int i = 1; i < n; i++)
+      x[i] += x[i - 1];
+  }
+
+  static void sinScalar(double *x, int n) {
+    for (int i = 0; i < n; i++)
+      x[i] = sin(x[i]);
+  }
+
+  static void cosScalar(double *x, int n) {
+    for (int i = 0; i < n; i++)
+      x[i] = cos(x[i]);
+  }
+
+  static void sqrtScalar(double *x, int n) {
+    for (int i = 0; i < n; i++)
+      x[i] = sqrt(x[i]);
+  }
+
+#if defined(__x86_64__)
+  /* sin and cos of the vector kernels: reduction by pi/4 in three parts and
+     the polynomials of the Cephes library, exact to about 1 ulp; arguments
+     above SinCosMaxArg lose the reduction and go through libm */
+  static const double SinCosMaxArg = 1.073741824e9;
+  static const double FourOverPi = 1.27323954473516268615;
+  static const double PiOver4Part1 = 7.85398125648498535156E-1;
+  static const double PiOver4Part2 = 3.77489470793079817668E-8;
+  static const double PiOver4Part3 = 2.69515142907905952645E-15;
+  static const double SinCoef[] = {
+    1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+    -1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1
+  };
+  static const double CosCoef[] = {
+    -1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+    2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2
+  };
+
+  /* AVX2 */
+  __attribute__((target("avx2,fma")))
+  static double horizontalSumAVX2(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+  }
+
+  __attribute__((target("avx2,fma")))
+  static double sumAVX2(const double *x, int n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i));
+      s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + i + 4));
+    }
+    double s = horizontalSumAVX2(_mm256_add_pd(s0, s1));
+    for (; i < n; i++)
+      s += x[i];
+    return s;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static double dotAVX2(const double *x, const double *y, int n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+      s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), s1);
+    }
+    double s = horizontalSumAVX2(_mm256_add_pd(s0, s1));
+    for (; i < n; i++)
+      s += x[i] * y[i];
+    return s;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void axpyAVX2(double a, const double *x, double *y, int n) {
+    __m256d va = _mm256_set1_pd(a);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    for (; i < n; i++)
+      y[i] += a * x[i];
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void scaleAVX2(double *x, double a, int n) {
+    __m256d va = _mm256_set1_pd(a);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(x + i, _mm256_mul_pd(va, _mm256_loadu_pd(x + i)));
+    for (; i < n; i++)
+      x[i] *= a;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static double minAVX2(const double *x, int n) {
+    __m256d m = _mm256_set1_pd(INFINITY);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      m = _mm256_min_pd(m, _mm256_loadu_pd(x + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = minScalar(lanes, 4);
+    for (; i < n; i++)
+      result = x[i] < result ? x[i] : result;
+    return result;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static double maxAVX2(const double *x, int n) {
+    __m256d m = _mm256_set1_pd(-INFINITY);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      m = _mm256_max_pd(m, _mm256_loadu_pd(x + i));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = maxScalar(lanes, 4);
+    for (; i < n; i++)
+      result = x[i] > result ? x[i] : result;
+    return result;
+  }
+
+  /* scan of four elements in two shifted adds, plus the total of the previous ones */
+  __attribute__((target("avx2,fma")))
+  static void prefixSumAVX2(double *x, int n) {
+    __m256d zero = _mm256_setzero_pd();
+    __m256d carry = zero;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      __m256d v = _mm256_loadu_pd(x + i);
+      v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+      v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+      v = _mm256_add_pd(v, carry);
+      _mm256_storeu_pd(x + i, v);
+      carry = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    for (; i < n; i++)
+      x[i] += i ? x[i - 1] : 0.0;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static __m256d polynomialAVX2(__m256d x, const double *coef) {
+    __m256d p = _mm256_set1_pd(coef[0]);
+    for (int k = 1; k < 6; k++)
+      p = _mm256_fmadd_pd(p, x, _mm256_set1_pd(coef[k]));
+    return p;
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void sinCosAVX2(double *x, int n, bool isCos) {
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+      __m256d v = _mm256_loadu_pd(x + i);
+      __m256d ax = _mm256_andnot_pd(signBit, v);
+      if (_mm256_movemask_pd(_mm256_cmp_pd(ax, _mm256_set1_pd(SinCosMaxArg), _CMP_GT_OQ)))
+      {
+        isCos ? cosScalar(x + i, 4) : sinScalar(x + i, 4);
+        continue;
+      }
+      // octant j of |x|, made even, then the sign flip of the upper four octants
+      __m256d y = _mm256_floor_pd(_mm256_mul_pd(ax, _mm256_set1_pd(FourOverPi)));
+      y = _mm256_add_pd(y, _mm256_fnmadd_pd(_mm256_set1_pd(2.0),
+        _mm256_floor_pd(_mm256_mul_pd(y, _mm256_set1_pd(0.5))), y));
+      __m256d j = _mm256_fnmadd_pd(_mm256_set1_pd(8.0),
+        _mm256_floor_pd(_mm256_mul_pd(y, _mm256_set1_pd(0.125))), y);
+      __m256d upper = _mm256_cmp_pd(j, _mm256_set1_pd(3.0), _CMP_GT_OQ);
+      j = _mm256_sub_pd(j, _mm256_and_pd(upper, _mm256_set1_pd(4.0)));
+
+      __m256d z = _mm256_fnmadd_pd(y, _mm256_set1_pd(PiOver4Part1), ax);
+      z = _mm256_fnmadd_pd(y, _mm256_set1_pd(PiOver4Part2), z);
+      z = _mm256_fnmadd_pd(y, _mm256_set1_pd(PiOver4Part3), z);
+      __m256d zz = _mm256_mul_pd(z, z);
+      __m256d sinPoly = _mm256_fmadd_pd(_mm256_mul_pd(z, zz), polynomialAVX2(zz, SinCoef), z);
+      __m256d cosPoly = _mm256_fmadd_pd(_mm256_mul_pd(zz, zz), polynomialAVX2(zz, CosCoef),
+        _mm256_fnmadd_pd(_mm256_set1_pd(0.5), zz, _mm256_set1_pd(1.0)));
+      __m256d swap = _mm256_or_pd(_mm256_cmp_pd(j, _mm256_set1_pd(1.0), _CMP_EQ_OQ),
+        _mm256_cmp_pd(j, _mm256_set1_pd(2.0), _CMP_EQ_OQ));
+
+      __m256d r, sign;
+      if (isCos)
+      {
+        r = _mm256_blendv_pd(cosPoly, sinPoly, swap);
+        sign = _mm256_xor_pd(_mm256_and_pd(upper, signBit),
+          _mm256_and_pd(_mm256_cmp_pd(j, _mm256_set1_pd(1.0), _CMP_GT_OQ), signBit));
+      }
+      else
+      {
+        r = _mm256_blendv_pd(sinPoly, cosPoly, swap);
+        sign = _mm256_xor_pd(_mm256_and_pd(v, signBit), _mm256_and_pd(upper, signBit));
+      }
+      _mm256_storeu_pd(x + i, _mm256_xor_pd(r, sign));
+    }
+    isCos ? cosScalar(x + i, n - i) : sinScalar(x + i, n - i);
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void sinAVX2(double *x, int n) {
+    sinCosAVX2(x, n, false);
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void cosAVX2(double *x, int n) {
+    sinCosAVX2(x, n, true);
+  }
+
+  __attribute__((target("avx2,fma")))
+  static void sqrtAVX2(double *x, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(x + i, _mm256_sqrt_pd(_mm256_loadu_pd(x + i)));
+    sqrtScalar(x + i, n - i);
+  }
+
+  /* AVX-512: the remainder of the 8 lanes is done with masked loads and stores */
+  __attribute__((target("avx512f")))
+  static __mmask8 tailMask512(int remaining) {
+    return (__mmask8)((1u << remaining) - 1);
+  }
+
+  __attribute__((target("avx512f")))
+  static double sumAVX512(const double *x, int n) {
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+      s0 = _mm512_add_pd(s0, _mm512_loadu_pd(x + i));
+      s1 = _mm512_add_pd(s1, _mm512_loadu_pd(x + i + 8));
+    }
+    for (; i < n; i += 8)
+      s0 = _mm512_add_pd(s0, _mm512_maskz_loadu_pd(tailMask512(n - i < 8 ? n - i : 8), x + i));
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+  }
+
+  __attribute__((target("avx512f")))
+  static double dotAVX512(const double *x, const double *y, int n) {
+    __m512d s0 = _mm512_setzero_pd(), s1 = _mm512_setzero_pd();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+      s0 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), s0);
+      s1 = _mm512_fmadd_pd(_mm512_loadu_pd(x + i + 8), _mm512_loadu_pd(y + i + 8), s1);
+    }
+    for (; i < n; i += 8)
+    {
+      __mmask8 m = tailMask512(n - i < 8 ? n - i : 8);
+      s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, x + i), _mm512_maskz_loadu_pd(m, y + i), s0);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(s0, s1));
+  }
+
+  __attribute__((target("avx512f")))
+  static void axpyAVX512(double a, const double *x, double *y, int n) {
+    __m512d va = _mm512_set1_pd(a);
+    for (int i = 0; i < n; i += 8)
+    {
+      __mmask8 m = tailMask512(n - i < 8 ? n - i : 8);
+      _mm512_mask_storeu_pd(y + i, m,
+        _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(m, x + i), _mm512_maskz_loadu_pd(m, y + i)));
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  static void scaleAVX512(double *x, double a, int n) {
+    __m512d va = _mm512_set1_pd(a);
+    for (int i = 0; i < n; i += 8)
+    {
+      __mmask8 m = tailMask512(n - i < 8 ? n - i : 8);
+      _mm512_mask_storeu_pd(x + i, m, _mm512_mul_pd(va, _mm512_maskz_loadu_pd(m, x + i)));
+    }
+  }
+
+  __attribute__((target("avx512f")))
+  static double minAVX512(const double *x, int n) {
+    __m512d m = _mm512_set1_pd(INFINITY);
+    for (int i = 0; i < n; i += 8)
+      m = _mm512_min_pd(m, _mm512_mask_loadu_pd(m, tailMask512(n - i < 8 ? n - i : 8), x + i));
+    return _mm512_reduce_min_pd(m);
+  }
+
+  __attribute__((target("avx512f")))
+  static double maxAVX512(const double *x, int n) {
+    __m512d m = _mm512_set1_pd(-INFINITY);
+    for (int i = 0; i < n; i += 8)
+      m = _mm512_max_pd(m, _mm512_mask_loadu_pd(m, tailMask512(n - i < 8 ? n - i : 8), x + i));
+    return _mm512_reduce_max_pd(m);
+  }
+
+  __attribute__((target("avx512f")))
+  static __m512d polynomialAVX512(__m512d x, const double *coef) {
+    __m512d p = _mm512_set1_pd(coef[0]);
+    for (int k = 1; k < 6; k++)
+      p = _mm512_fmadd_pd(p, x, _mm512_set1_pd(coef[k]));
+    return p;
+  }
+
+  /* the same reduction as sinCosAVX2, with mask registers for the lane selections */
+  __attribute__((target("avx512f")))
+  static void sinCosAVX512(double *x, int n, bool isCos) {
+    const __m512i signBit = _mm512_set1_epi64((long long)0x8000000000000000ULL);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+      __m512d v = _mm512_loadu_pd(x + i);
+      __m512d ax = _mm512_abs_pd(v);
+      if (_mm512_cmp_pd_mask(ax, _mm512_set1_pd(SinCosMaxArg), _CMP_GT_OQ))
+      {
+        isCos ? cosScalar(x + i, 8) : sinScalar(x + i, 8);
+        continue;
+      }
+      __m512d y = _mm512_roundscale_pd(_mm512_mul_pd(ax, _mm512_set1_pd(FourOverPi)),
+        _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+      __m512d half = _mm512_roundscale_pd(_mm512_mul_pd(y, _mm512_set1_pd(0.5)),
+        _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+      y = _mm512_add_pd(y, _mm512_fnmadd_pd(_mm512_set1_pd(2.0), half, y));
+      __m512d eighth = _mm512_roundscale_pd(_mm512_mul_pd(y, _mm512_set1_pd(0.125)),
+        _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+      __m512d j = _mm512_fnmadd_pd(_mm512_set1_pd(8.0), eighth, y);
+      __mmask8 upper = _mm512_cmp_pd_mask(j, _mm512_set1_pd(3.0), _CMP_GT_OQ);
+      j = _mm512_mask_sub_pd(j, upper, j, _mm512_set1_pd(4.0));
+
+      __m512d z = _mm512_fnmadd_pd(y, _mm512_set1_pd(PiOver4Part1), ax);
+      z = _mm512_fnmadd_pd(y, _mm512_set1_pd(PiOver4Part2), z);
+      z = _mm512_fnmadd_pd(y, _mm512_set1_pd(PiOver4Part3), z);
+      __m512d zz = _mm512_mul_pd(z, z);
+      __m512d sinPoly = _mm512_fmadd_pd(_mm512_mul_pd(z, zz), polynomialAVX512(zz, SinCoef), z);
+      __m512d cosPoly = _mm512_fmadd_pd(_mm512_mul_pd(zz, zz), polynomialAVX512(zz, CosCoef),
+        _mm512_fnmadd_pd(_mm512_set1_pd(0.5), zz, _mm512_set1_pd(1.0)));
+      __mmask8 swap = _mm512_cmp_pd_mask(j, _mm512_set1_pd(1.0), _CMP_EQ_OQ)
+        | _mm512_cmp_pd_mask(j, _mm512_set1_pd(2.0), _CMP_EQ_OQ);
+
+      __m512d r;
+      __mmask8 negative;
+      if (isCos)
+      {
+        r = _mm512_mask_blend_pd(swap, cosPoly, sinPoly);
+        negative = upper ^ _mm512_cmp_pd_mask(j, _mm512_set1_pd(1.0), _CMP_GT_OQ);
+      }
+      else
+      {
+        r = _mm512_mask_blend_pd(swap, sinPoly, cosPoly);
+        negative = upper ^ _mm512_cmp_pd_mask(v, _mm512_setzero_pd(), _CMP_LT_OQ);
+      }
+      __m512i bits = _mm512_castpd_si512(r);
+      _mm512_storeu_pd(x + i, _mm512_castsi512_pd(_mm512_mask_xor_epi64(bits, negative, bits, signBit)));
+    }
+    isCos ? cosScalar(x + i, n - i) : sinScalar(x + i, n - i);
+  }
+
+  __attribute__((target("avx512f")))
+  static void sinAVX512(double *x, int n) {
+    sinCosAVX512(x, n, false);
+  }
+
+  __attribute__((target("avx512f")))
+  static void cosAVX512(double *x, int n) {
+    sinCosAVX512(x, n, true);
+  }
+
+  __attribute__((target("avx512f")))
+  static void sqrtAVX512(double *x, int n) {
+    for (int i = 0; i < n; i += 8)
+    {
+      __mmask8 m = tailMask512(n - i < 8 ? n - i : 8);
+      _mm512_mask_storeu_pd(x + i, m, _mm512_sqrt_pd(_mm512_maskz_loadu_pd(m, x + i)));
+    }
+  }
+#endif
+
+  static VectorKernels selectKernels() {
+    VectorKernels k = {
+      sumScalar, dotScalar, axpyScalar, scaleScalar, minScalar, maxScalar,
+      prefixSumScalar, sinScalar, cosScalar, sqrtScalar
+    };
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    VectorKernels avx2 = {
+      sumAVX2, dotAVX2, axpyAVX2, scaleAVX2, minAVX2, maxAVX2,
+      prefixSumAVX2, sinAVX2, cosAVX2, sqrtAVX2
+    };
+    // the scan is bound by its carry, it stays on AVX2
+    VectorKernels avx512 = {
+      sumAVX512, dotAVX512, axpyAVX512, scaleAVX512, minAVX512, maxAVX512,
+      prefixSumAVX2, sinAVX512, cosAVX512, sqrtAVX512
+    };
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      k = __builtin_cpu_supports("avx512f") ? avx512 : avx2;
+#endif
+    return k;
+  }
+
+  static const VectorKernels &vectorKernels() {
+    static const VectorKernels kernels = selectKernels();
+    return kernels;
+  }
+
+  static void checkSameLength(const char *name, Array *x, Array *y) {
+    if (x->length == y->length)
+      return;
+    flush();
+    fprintf(stderr, "%s: arrays of lengths %d and %d\n", name, x->length, y->length);
+    exit(1);
+  }
+
+  double __vec_sum(Array *x) {
+    return vectorKernels().sum((const double *)x->buf, x->length);
+  }
+
+  double __vec_dot(Array *x, Array *y) {
+    checkSameLength("dot", x, y);
+    return vectorKernels().dot((const double *)x->buf, (const double *)y->buf, x->length);
+  }
+
+  /* y = a * x + y */
+  Array *__vec_axpy(double a, Array *x, Array *y) {
+    checkSameLength("axpy", x, y);
+    vectorKernels().axpy(a, (const double *)x->buf, (double *)y->buf, x->length);
+    __array_retain(y);
+    return y;
+  }
+
+  Array *__vec_scale(Array *x, double a) {
+    vectorKernels().scale((double *)x->buf, a, x->length);
+    __array_retain(x);
+    return x;
+  }
+
+  /* INFINITY and -INFINITY for empty arrays */
+  double __vec_min(Array *x) {
+    return vectorKernels().min((const double *)x->buf, x->length);
+  }
+
+  double __vec_max(Array *x) {
+    return vectorKernels().max((const double *)x->buf, x->length);
+  }
+
+  Array *__vec_prefix_sum(Array *x) {
+    vectorKernels().prefixSum((double *)x->buf, x->length);
+    __array_retain(x);
+    return x;
+  }
+
+  Array *__vec_vsin(Array *x) {
+    vectorKernels().sin((double *)x->buf, x->length);
+    __array_retain(x);
+    return x;
+  }
+
+  Array *__vec_vcos(Array *x) {
+    vectorKernels().cos((double *)x->buf, x->length);
+    __array_retain(x);
     return x;
   }
+
+  Array *__vec_vsqrt(Array *x) {
+    vectorKernels().sqrt((double *)x->buf, x->length);
+    __array_retain(x);
+    return x;
+  }
+
+  /* PARALLEL FOR: a pool of worker threads runs the chunks of parallel for
+     loops. Every worker starts on its own share of the iterations and, when it
+     runs out, steals half of what another worker has left. The calling thread
+     is worker 0; loops nested in a parallel loop run on the worker calling them. */
+  typedef void (*ParallelBody)(int begin, int end, void *env, void *partial);
+  typedef void (*ParallelMerge)(void *into, void *from);
+
+  struct alignas(64) WorkerRange {
+    std::mutex lock;
+    int next = 0, end = 0;
+  };
+
+  struct ThreadPool {
+    int numWorkers = 0; /* 0 until __parallel_init or the first loop */
+    std::vector<std::thread> threads;
+    std::unique_ptr<WorkerRange[]> ranges;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    unsigned long long generation = 0;
+    int running = 0;
+    bool stop = false;
+    /* the loop being run */
+    ParallelBody body = 0;
+    void *env = 0;
+    char *partials = 0;
+    long long partialSize = 0;
+    int grain = 1;
+  };
+  /* never destroyed, threads of a REPL session are still waiting at exit */
+  static ThreadPool &pool = *new ThreadPool();
+  static thread_local bool inParallelLoop = false;
+
+  static bool takeChunk(int worker, int *begin, int *end) {
+    WorkerRange &own = pool.ranges[worker];
+    for (;;)
+    {
+      {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.next < own.end)
+        {
+          *begin = own.next;
+          *end = own.next + std::min(pool.grain, own.end - own.next);
+          own.next = *end;
+          return true;
+        }
+      }
+      // the thieves only shrink ranges, so one empty pass means the loop is done
+      int stolenBegin = 0, stolenEnd = 0;
+      for (int k = 1; k < pool.numWorkers && stolenBegin == stolenEnd; k++)
+      {
+        WorkerRange &victim = pool.ranges[(worker + k) % pool.numWorkers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        int remaining = victim.end - victim.next;
+        if (remaining > 0)
+        {
+          stolenEnd = victim.end;
+          stolenBegin = victim.end - (remaining + 1) / 2;
+          victim.end = stolenBegin;
+        }
+      }
+      if (stolenBegin == stolenEnd)
+        return false;
+      std::lock_guard<std::mutex> guard(own.lock);
+      own.next = stolenBegin;
+      own.end = stolenEnd;
+    }
+  }
+
+  static void runChunks(int worker) {
+    void *partial = pool.partials + worker * pool.partialSize;
+    int begin, end;
+    while (takeChunk(worker, &begin, &end))
+      pool.body(begin, end, pool.env, partial);
+  }
+
+  /* seen is the generation of the last loop before the worker was started */
+  static void workerMain(int worker, unsigned long long seen) {
+    inParallelLoop = true;
+    for (;;)
+    {
+      {
+        std::unique_lock<std::mutex> guard(pool.lock);
+        pool.wake.wait(guard, [&] { return pool.stop || pool.generation != seen; });
+        if (pool.stop)
+        {
+          guard.unlock();
+          releaseOutput();
+          return;
+        }
+        seen = pool.generation;
+      }
+      runChunks(worker);
+      flush(); /* what the loop printed is out when it returns */
+      std::lock_guard<std::mutex> guard(pool.lock);
+      if (--pool.running == 0)
+        pool.done.notify_one();
+    }
+  }
+
+  /* threads <= 0 is one worker per core; takes effect when the pool is started */
+  void __parallel_init(int threads) {
+    if (!pool.threads.empty())
+      return;
+    pool.numWorkers = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  void __parallel_for(ParallelBody body, ParallelMerge merge, int begin, int end,
+                      void *env, void *result, long long partialSize) {
+    if (end <= begin)
+      return;
+    if (!pool.numWorkers)
+      __parallel_init(0);
+    if (inParallelLoop || pool.numWorkers == 1 || end - begin == 1)
+    {
+      body(begin, end, env, result);
+      return;
+    }
+    if (pool.threads.empty())
+    {
+      pool.ranges.reset(new WorkerRange[pool.numWorkers]);
+      for (int w = 1; w < pool.numWorkers; w++)
+        pool.threads.emplace_back(workerMain, w, pool.generation);
+    }
+    flush(); /* the output before the loop precedes what the workers print */
+
+    // every worker starts from the identities in result
+    int n = pool.numWorkers;
+    char *partials = (char *)malloc(n * partialSize + 1);
+    if (!partials)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    for (int w = 0; w < n; w++)
+      memcpy(partials + w * partialSize, result, partialSize);
+
+    long long total = (long long)end - begin;
+    for (int w = 0; w < n; w++)
+    {
+      pool.ranges[w].next = begin + (int)(total * w / n);
+      pool.ranges[w].end = begin + (int)(total * (w + 1) / n);
+    }
+    {
+      std::lock_guard<std::mutex> guard(pool.lock);
+      pool.body = body;
+      pool.env = env;
+      pool.partials = partials;
+      pool.partialSize = partialSize;
+      pool.grain = (int)std::max(1LL, total / (n * 64LL));
+      pool.running = n - 1;
+      pool.generation++;
+    }
+    pool.wake.notify_all();
+
+    inParallelLoop = true;
+    runChunks(0);
+    inParallelLoop = false;
+    {
+      std::unique_lock<std::mutex> guard(pool.lock);
+      pool.done.wait(guard, [] { return pool.running == 0; });
+    }
+
+    if (merge)
+      for (int w = 0; w < n; w++)
+        merge(result, partials + w * partialSize);
+    free(partials);
+  }
+
+  void __parallel_shutdown() {
+    {
+      std::lock_guard<std::mutex> guard(pool.lock);
+      pool.stop = true;
+    }
+    pool.wake.notify_all();
+    for (std::thread &thread : pool.threads)
+      thread.join();
+    pool.threads.clear();
+    pool.ranges.reset();
+    pool.stop = false;
+  }
+
+  /* CSV FILES: a file is mapped read only and split into chunks of whole
+     lines, the rows of the chunks are counted in parallel when it is
+     opened. A column is parsed, in parallel chunks, into an int[] or a
+     double[] the first time it is asked for. The first line holds the
+     column names; the separator is a tab if the first line has one, else a
+     comma. Quoted fields may hold separators but not newlines. */
+  static const long long CSV_CHUNKSIZE = 1 << 22;
+
+  struct CsvChunk {
+    const char *begin;
+    const char *end;
+    int firstRow;
+    int rows;
+  };
+
+  struct CsvFile {
+    const char *data;
+    long long size;
+    char separator;
+    int rows;
+    std::vector<std::string> names;
+    std::vector<CsvChunk> chunks;
+    std::vector<Array *> intColumns;
+    std::vector<Array *> doubleColumns;
+  };
+
+  static std::mutex csvLock; /* guards csvFiles and the columns parsed so far */
+  static std::vector<CsvFile *> csvFiles; /* by handle, 0 once closed */
+
+  /* the start of the line after the one at p; lineEnd is set before its
+     newline and a carriage return */
+  static const char *csvLine(const char *p, const char *end, const char **lineEnd) {
+    const char *newline = (const char *)memchr(p, '\n', end - p);
+    const char *last = newline ? newline : end;
+    if (last > p && last[-1] == '\r')
+      last--;
+    *lineEnd = last;
+    return newline ? newline + 1 : end;
+  }
+
+  /* the end of the field at p, at a separator or lineEnd */
+  static const char *csvField(const char *p, const char *lineEnd, char separator) {
+    const char *next = (const char *)memchr(p, separator, lineEnd - p);
+    if (!next)
+      next = lineEnd;
+    if (!memchr(p, '"', next - p))
+      return next;
+    bool quoted = false;
+    for (; p < lineEnd && (quoted || *p != separator); p++)
+      if (*p == '"')
+        quoted = !quoted;
+    return p;
+  }
+
+  /* the text of a field without surrounding blanks and quotes */
+  static void csvTrim(const char **first, const char **last) {
+    while (*first < *last && (**first == ' ' || **first == '"'))
+      (*first)++;
+    while (*last > *first && ((*last)[-1] == ' ' || (*last)[-1] == '"'))
+      (*last)--;
+  }
+
+  /* the field in column of the line, false if the line is shorter */
+  static bool csvColumnField(const char *p, const char *lineEnd, char separator, int column,
+                             const char **first, const char **last) {
+    for (int i = 0; i < column; i++)
+    {
+      p = csvField(p, lineEnd, separator);
+      if (p == lineEnd)
+        return false;
+      p++;
+    }
+    *first = p;
+    *last = csvField(p, lineEnd, separator);
+    csvTrim(first, last);
+    return true;
+  }
+
+  static void csvCountRows(int begin, int end, void *env, void *partial) {
+    CsvFile *file = (CsvFile *)env;
+    for (int c = begin; c < end; c++)
+    {
+      CsvChunk &chunk = file->chunks[c];
+      const char *lineEnd;
+      for (const char *p = chunk.begin; p < chunk.end;)
+      {
+        const char *next = csvLine(p, chunk.end, &lineEnd);
+        if (lineEnd > p)
+          chunk.rows++;
+        p = next;
+      }
+    }
+  }
+
+  struct CsvColumnJob {
+    CsvFile *file;
+    int column;
+    Array *array;
+  };
+
+  /* fields that do not parse are 0 in int columns and NaN in double columns */
+  static void csvParseColumn(int begin, int end, void *env, void *partial) {
+    CsvColumnJob *job = (CsvColumnJob *)env;
+    CsvFile *file = job->file;
+    bool isDouble = job->array->elemSize == sizeof(double);
+    for (int c = begin; c < end; c++)
+    {
+      CsvChunk &chunk = file->chunks[c];
+      int row = chunk.firstRow;
+      const char *lineEnd;
+      for (const char *p = chunk.begin; p < chunk.end;)
+      {
+        const char *next = csvLine(p, chunk.end, &lineEnd);
+        if (lineEnd > p)
+        {
+          const char *first = 0, *last = 0;
+          if (!csvColumnField(p, lineEnd, file->separator, job->column, &first, &last))
+            first = last;
+          if (first < last && *first == '+')
+            first++;
+          if (isDouble)
+          {
+            double x;
+            if (std::from_chars(first, last, x).ec != std::errc())
+              x = NAN;
+            ((double *)job->array->buf)[row++] = x;
+          }
+          else
+          {
+            int x;
+            if (std::from_chars(first, last, x).ec != std::errc())
+              x = 0;
+            ((int *)job->array->buf)[row++] = x;
+          }
+        }
+        p = next;
+      }
+    }
+  }
+
+  /* the handle of the file, -1 if it can not be read */
+  int csv_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return -1;
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+    const char *data = 0;
+    if (info.st_size > 0)
+    {
+      void *mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED)
+      {
+        close(fd);
+        return -1;
+      }
+      madvise(mapping, info.st_size, MADV_WILLNEED);
+      data = (const char *)mapping;
+    }
+    close(fd); /* the mapping stays */
+
+    CsvFile *file = new CsvFile();
+    file->data = data;
+    file->size = info.st_size;
+    const char *end = data + info.st_size;
+    const char *headerEnd;
+    const char *p = data ? csvLine(data, end, &headerEnd) : 0;
+    file->separator = data && memchr(data, '\t', headerEnd - data) ? '\t' : ',';
+    for (const char *name = data; name && name <= headerEnd; name++)
+    {
+      const char *first = name, *last = csvField(name, headerEnd, file->separator);
+      name = last;
+      csvTrim(&first, &last);
+      file->names.push_back(std::string(first, last));
+    }
+
+    // chunks end at the line end after every CSV_CHUNKSIZE bytes
+    while (p < end)
+    {
+      const char *chunkEnd = end;
+      if (end - p > CSV_CHUNKSIZE)
+      {
+        const char *newline = (const char *)memchr(p + CSV_CHUNKSIZE, '\n', end - p - CSV_CHUNKSIZE);
+        chunkEnd = newline ? newline + 1 : end;
+      }
+      file->chunks.push_back({p, chunkEnd, 0, 0});
+      p = chunkEnd;
+    }
+    char unused;
+    __parallel_for(csvCountRows, 0, 0, (int)file->chunks.size(), file, &unused, 0);
+    long long rows = 0;
+    for (CsvChunk &chunk : file->chunks)
+    {
+      chunk.firstRow = (int)rows;
+      rows += chunk.rows;
+    }
+    if (rows > INT_MAX)
+    {
+      flush();
+      fprintf(stderr, "csv_open: %s has more than %d rows\n", path, INT_MAX);
+      exit(1);
+    }
+    file->rows = (int)rows;
+    file->intColumns.resize(file->names.size());
+    file->doubleColumns.resize(file->names.size());
+
+    std::lock_guard<std::mutex> guard(csvLock);
+    csvFiles.push_back(file);
+    return (int)csvFiles.size() - 1;
+  }
+
+  /* the caller holds csvLock */
+  static CsvFile *csvFile(const char *name, int handle) {
+    if (handle >= 0 && handle < (int)csvFiles.size() && csvFiles[handle])
+      return csvFiles[handle];
+    flush();
+    fprintf(stderr, "%s: %d is not an open CSV file\n", name, handle);
+    exit(1);
+  }
+
+  static Array *csvColumn(const char *name, int handle, int column, bool isDouble) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    CsvFile *file = csvFile(name, handle);
+    if (column < 0 || column >= (int)file->names.size())
+    {
+      flush();
+      fprintf(stderr, "%s: no column %d in a file of %d columns\n", name, column, (int)file->names.size());
+      exit(1);
+    }
+    Array *&array = isDouble ? file->doubleColumns[column] : file->intColumns[column];
+    if (!array)
+    {
+      CsvColumnJob job = {file, column, newArray(isDouble ? sizeof(double) : sizeof(int), file->rows)};
+      char unused;
+      __parallel_for(csvParseColumn, 0, 0, (int)file->chunks.size(), &job, &unused, 0);
+      array = job.array;
+    }
+    __array_retain(array);
+    return array;
+  }
+
+  int csv_rows(int handle) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    return csvFile("csv_rows", handle)->rows;
+  }
+
+  int csv_columns(int handle) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    return (int)csvFile("csv_columns", handle)->names.size();
+  }
+
+  /* the index of the column with the name, -1 if there is none */
+  int csv_column(int handle, const char *name) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    std::vector<std::string> &names = csvFile("csv_column", handle)->names;
+    for (size_t i = 0; i < names.size(); i++)
+      if (names[i] == name)
+        return (int)i;
+    return -1;
+  }
+
+  const char *csv_name(int handle, int column) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    CsvFile *file = csvFile("csv_name", handle);
+    if (column < 0 || column >= (int)file->names.size())
+      return "";
+    return file->names[column].c_str();
+  }
+
+  /* the same array on every call for a column; the file holds a reference,
+     so it stays while the program holds one after csv_close */
+  Array *csv_ints(int handle, int column) {
+    return csvColumn("csv_ints", handle, column, false);
+  }
+
+  Array *csv_doubles(int handle, int column) {
+    return csvColumn("csv_doubles", handle, column, true);
+  }
+
+  int csv_close(int handle) {
+    std::lock_guard<std::mutex> guard(csvLock);
+    CsvFile *file = csvFile("csv_close", handle);
+    if (file->data)
+      munmap((void *)file->data, file->size);
+    for (Array *array : file->intColumns)
+      __array_release(array);
+    for (Array *array : file->doubleColumns)
+      __array_release(array);
+    delete file;
+    csvFiles[handle] = 0;
+    return 0;
+  }
+
+  /* PROFILING: counters of -fprofile-generate code, written when main returns
+     or, if the program ends in exit(), at exit */
+  typedef struct {
+    const char *name;
+    long long *counters;
+    int numCounters;
+  } ProfiledFunction;
+  static ProfiledFunction *profiledFunctions = 0;
+  static int numProfiledFunctions = 0;
+  static const char *profileFile = 0; /* until the profile is written */
+
+  static void writeProfileAtExit() {
+    if (profileFile)
+      __prof_write(profileFile);
+  }
+
+  void __prof_init(const char *fileName) {
+    static bool isAtExitRegistered = false;
+    if (!isAtExitRegistered)
+      atexit(writeProfileAtExit);
+    isAtExitRegistered = true;
+    profileFile = fileName;
+  }
+
+  void __prof_register(const char *name, long long *counters, int numCounters) {
+    profiledFunctions = (ProfiledFunction *)realloc(profiledFunctions,
+      (numProfiledFunctions + 1) * sizeof(ProfiledFunction));
+    if (!profiledFunctions)
+    {
+      printf("Malloc failed!\n");
+      exit(1);
+    }
+    profiledFunctions[numProfiledFunctions].name = name;
+    profiledFunctions[numProfiledFunctions].counters = counters;
+    profiledFunctions[numProfiledFunctions].numCounters = numCounters;
+    numProfiledFunctions++;
+  }
+
+  void __prof_write(const char *fileName) {
+    FILE *f = fopen(fileName, "w");
+    if (!f)
+    {
+      printf("Can not write profile %s\n", fileName);
+      return;
+    }
+    for (int i = 0; i < numProfiledFunctions; i++)
+    {
+      ProfiledFunction *fn = &profiledFunctions[i];
+      fprintf(f, "%s %d\n", fn->name, fn->numCounters);
+      for (int j = 0; j < fn->numCounters; j++)
+        fprintf(f, j ? " %lld" : "%lld", fn->counters[j]);
+      fputc('\n', f);
+    }
+    fclose(f);
+    // the counters may be freed with the JIT code after main returns
+    free(profiledFunctions);
+    profiledFunctions = 0;
+    numProfiledFunctions = 0;
+    profileFile = 0;
+  }
 }
@@ -1,16 +1,85 @@
 /* External C functions accessible from inside the language */
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+/* storage of int[] and double[] values; the compiled code reads the header
+   and the elements in place, see Codegen::createArrayElementAddress */
+typedef struct {
+  int refCount;
+  int elemSize;
+  int length;
+  int maxLength;
+  void *buf;
+} Array;
 
 extern "C"
 {
-  /* IO */
+  /* IO, buffered per thread until flush() or exit */
   int printi(int X);
   int printd(double X);
+  int printr(double X);
   int print(const char *fmt, ...);
   int println(const char *fmt, ...);
+  int flush();
+  int output_file(const char *path);
+  int output_stdout();
 
   int readi();
   double readd();
   char *readline();
+  int next_int();
+  double next_double();
+  int has_next();
+
+  /* ARRAYS */
+  Array *int_array(int length);
+  Array *double_array(int length);
+  void __array_grow(Array *array);
+  void __array_bounds(int index, int length);
+  void __array_retain(Array *array);
+  void __array_release(Array *array);
+
+  /* BULK INPUT of whitespace separated numbers from stdin */
+  int read_ints(Array *array);
+  int read_doubles(Array *array);
+  Array *read_all_ints();
+  Array *read_all_doubles();
+
+  /* VECTOR KERNELS on double[], called as sum, dot, ... unless the program
+     defines a function of the name; those returning an array update it in
+     place and return a new reference to it */
+  double __vec_sum(Array *x);
+  double __vec_dot(Array *x, Array *y);
+  Array *__vec_axpy(double a, Array *x, Array *y);
+  Array *__vec_scale(Array *x, double a);
+  double __vec_min(Array *x);
+  double __vec_max(Array *x);
+  Array *__vec_prefix_sum(Array *x);
+  Array *__vec_vsin(Array *x);
+  Array *__vec_vcos(Array *x);
+  Array *__vec_vsqrt(Array *x);
+
+  /* PARALLEL FOR, called from the code of parallel for loops */
+  void __parallel_init(int threads);
+  void __parallel_for(void (*body)(int begin, int end, void *env, void *partial),
+                      void (*merge)(void *into, void *from), int begin, int end,
+                      void *env, void *result, long long partialSize);
+  void __parallel_shutdown();
+
+  /* CSV FILES, mapped read only; columns are parsed on first use */
+  int csv_open(const char *path);
+  int csv_rows(int handle);
+  int csv_columns(int handle);
+  int csv_column(int handle, const char *name);
+  const char *csv_name(int handle, int column);
+  Array *csv_ints(int handle, int column);
+  Array *csv_doubles(int handle, int column);
+  int csv_close(int handle);
+
+  /* PROFILING, called from -fprofile-generate code */
+  void __prof_init(const char *fileName);
+  void __prof_register(const char *name, long long *counters, int numCounters);
+  void __prof_write(const char *fileName);
 
   /* MATH */
   double fabs(double X);
@@ -20,3 +89,5 @@ extern "C"
   double pow(double base, double exponent);
   double pi();
 }
+
+#endif
@@ -0,0 +1,331 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "AST.h"
+#include "codegen.h"
+#include "session.h"
+#include "server.h"
+
+/* The protocol is line based headers followed by raw bytes:
+     request:  command, opt level, CPU, features, name, bounds checks,
+               parallel threads, codegen threads, lazy, profile generate,
+               profile file, profile use, JIT cache, JIT cache size,
+               source length, input length, source, input
+     response: exit status, output length, result length, output, result
+   The input is the stdin of a program run by the server. */
+
+static bool writeAll(int fd, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = write(fd, data, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+static bool readAll(int fd, std::string &data, size_t length)
+{
+  data.resize(length);
+  size_t done = 0;
+  while (done < length)
+  {
+    ssize_t n = read(fd, &data[done], length - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+/* headers are short, they are read a byte at a time */
+static bool readLine(int fd, std::string &line)
+{
+  line.clear();
+  char c;
+  for (;;)
+  {
+    ssize_t n = read(fd, &c, 1);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    if (c == '\n')
+      return true;
+    line += c;
+  }
+}
+
+static bool readNumber(int fd, size_t &value)
+{
+  std::string line;
+  if (!readLine(fd, line))
+    return false;
+  value = std::strtoull(line.c_str(), nullptr, 10);
+  return true;
+}
+
+static std::string readFile(const std::string &path)
+{
+  std::ifstream file(path, std::ios::binary);
+  std::ostringstream data;
+  data << file.rdbuf();
+  return data.str();
+}
+
+/* -1 with errno set if the path does not fit in sun_path, 107 bytes on Linux */
+static int openSocket(const std::string &socketPath, sockaddr_un &address)
+{
+  if (socketPath.size() >= sizeof(address.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+  return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+/* Sessions made by the server before it forks, keyed by CPU and features;
+   making one creates the JIT and the target machine, which is most of the
+   start of a request. A worker takes the copy it inherited if one matches
+   its request. They are never freed, exit() leaves them to the system. */
+typedef std::map<std::pair<std::string, std::string>, CompilationSession *> WarmSessions;
+
+/* runs in the worker process; stdout and stderr go to the capture file */
+static int compileRequest(const ServerRequest &request, const std::string &resultFile,
+                          const WarmSessions &warmSessions)
+{
+  auto warm = warmSessions.find({request.CPU, request.Features});
+  CompilationSession &session = warm != warmSessions.end() ? *warm->second
+    : *new CompilationSession(request.CPU, request.Features);
+  Codegen &context = session.Context;
+  context.setOptimizationLevel(request.OptLevel);
+  context.setBoundsChecks(request.BoundsChecks);
+  context.setParallelThreads(request.ParallelThreads);
+  context.setCodegenThreads(request.CodegenThreads);
+  context.setProfileGenerate(request.ProfileGenerate, request.ProfileFile);
+  bool isRun = request.Command == "run";
+  context.setLazyCompilation(request.Lazy && isRun);
+  if (!request.JITCache.empty() && isRun)
+    context.setJITCache(request.JITCache, request.JITCacheSize);
+  if (!request.ProfileUse.empty() && !context.loadProfile(request.ProfileUse))
+    return 1;
+
+  if (!session.readSource(request.Source))
+    return 1;
+  if (!session.parse())
+    return 2;
+  if (!context.typeCheck(*session.ProgramBlock))
+  {
+    std::cout << "Type errors found. Can not run code." << std::endl;
+    return 1;
+  }
+
+  if (request.Command == "emit-llvm")
+  {
+    context.generateCode(*session.ProgramBlock, true, true, resultFile);
+    context.out->flush();
+  }
+  else if (request.Command == "run")
+  {
+    context.generateCode(*session.ProgramBlock, true, false, "");
+    context.runCode(request.Name);
+  }
+  else
+  {
+    // the client reports the file it wrote, not the server's temporary one
+    std::streambuf *console = std::cout.rdbuf(nullptr);
+    bool isWritten = context.writeObjFile(*session.ProgramBlock, resultFile);
+    std::cout.rdbuf(console);
+    std::cout.clear();
+    if (!isWritten)
+      return 1;
+  }
+  return 0;
+}
+
+/* one connection, in a process of its own: the request is compiled or run
+   by another fork, so exit() in the program or a crash still gets a reply */
+static void serveConnection(int fd, const WarmSessions &warmSessions)
+{
+  ServerRequest request;
+  size_t optLevel, boundsChecks, parallelThreads, codegenThreads, lazy, profileGenerate;
+  size_t sourceLength, inputLength;
+  if (!readLine(fd, request.Command) || !readNumber(fd, optLevel) ||
+      !readLine(fd, request.CPU) || !readLine(fd, request.Features) ||
+      !readLine(fd, request.Name) || !readNumber(fd, boundsChecks) ||
+      !readNumber(fd, parallelThreads) || !readNumber(fd, codegenThreads) ||
+      !readNumber(fd, lazy) || !readNumber(fd, profileGenerate) ||
+      !readLine(fd, request.ProfileFile) || !readLine(fd, request.ProfileUse) ||
+      !readLine(fd, request.JITCache) || !readNumber(fd, request.JITCacheSize) ||
+      !readNumber(fd, sourceLength) || !readNumber(fd, inputLength) ||
+      !readAll(fd, request.Source, sourceLength) || !readAll(fd, request.Input, inputLength))
+    return;
+  request.OptLevel = optLevel;
+  request.BoundsChecks = boundsChecks;
+  request.ParallelThreads = parallelThreads;
+  request.CodegenThreads = codegenThreads;
+  request.Lazy = lazy;
+  request.ProfileGenerate = profileGenerate;
+
+  char capturePath[] = "/tmp/compiler-output-XXXXXX";
+  char resultPath[] = "/tmp/compiler-result-XXXXXX";
+  char inputPath[] = "/tmp/compiler-input-XXXXXX";
+  int captureFD = mkstemp(capturePath);
+  int resultFD = mkstemp(resultPath);
+  int inputFD = mkstemp(inputPath);
+  if (captureFD < 0 || resultFD < 0 || inputFD < 0)
+    return;
+  close(resultFD);
+  // the program reads the input sent with the request, never the server's stdin
+  unlink(inputPath);
+  if (!writeAll(inputFD, request.Input.data(), request.Input.size()) ||
+      lseek(inputFD, 0, SEEK_SET) < 0)
+  {
+    unlink(capturePath);
+    unlink(resultPath);
+    return;
+  }
+
+  int status;
+  pid_t worker = fork();
+  if (worker == 0)
+  {
+    dup2(inputFD, STDIN_FILENO);
+    dup2(captureFD, STDOUT_FILENO);
+    dup2(captureFD, STDERR_FILENO);
+    int result = compileRequest(request, resultPath, warmSessions);
+    std::cout.flush();
+    errs().flush();
+    outs().flush();
+    exit(result);
+  }
+  if (worker < 0 || waitpid(worker, &status, 0) < 0)
+    status = 1;
+  else if (WIFEXITED(status))
+    status = WEXITSTATUS(status);
+  else
+    status = 128 + WTERMSIG(status);
+  close(captureFD);
+  close(inputFD);
+
+  std::string output = readFile(capturePath);
+  std::string result = request.Command == "run" ? "" : readFile(resultPath);
+  unlink(capturePath);
+  unlink(resultPath);
+
+  std::string header = std::to_string(status) + "\n" + std::to_string(output.size()) + "\n" +
+    std::to_string(result.size()) + "\n";
+  if (writeAll(fd, header.data(), header.size()) && writeAll(fd, output.data(), output.size()))
+    writeAll(fd, result.data(), result.size());
+}
+
+int runServer(const std::string &socketPath)
+{
+  // everything a request needs from LLVM is set up once, before the forks;
+  // the server process itself never starts a thread, the JIT of a session
+  // only does when it compiles
+  Codegen::initializeTargets();
+  WarmSessions warmSessions;
+  warmSessions[{"", ""}] = new CompilationSession();
+  warmSessions[{"native", ""}] = new CompilationSession("native", "");
+
+  sockaddr_un address;
+  int listenFD = openSocket(socketPath, address);
+  if (listenFD >= 0)
+    unlink(socketPath.c_str());
+  if (listenFD < 0 || bind(listenFD, (sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(listenFD, SOMAXCONN) < 0)
+  {
+    std::cerr << "Error: can not listen on " << socketPath << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::cout << "Listening on " << socketPath << std::endl;
+
+  // connection processes are not waited for
+  signal(SIGCHLD, SIG_IGN);
+  for (;;)
+  {
+    int fd = accept(listenFD, nullptr, nullptr);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      std::cerr << "Error: accept failed: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    std::cout.flush();
+    pid_t connection = fork();
+    if (connection == 0)
+    {
+      close(listenFD);
+      signal(SIGCHLD, SIG_DFL);
+      serveConnection(fd, warmSessions);
+      close(fd);
+      _exit(0);
+    }
+    close(fd);
+  }
+}
+
+int runClient(const std::string &socketPath, const ServerRequest &request,
+              const std::string &resultFile)
+{
+  sockaddr_un address;
+  int fd = openSocket(socketPath, address);
+  if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) < 0)
+  {
+    std::cerr << "Error: can not connect to " << socketPath << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+
+  std::string header = request.Command + "\n" + std::to_string(request.OptLevel) + "\n" +
+    request.CPU + "\n" + request.Features + "\n" + request.Name + "\n" +
+    std::to_string(request.BoundsChecks) + "\n" + std::to_string(request.ParallelThreads) + "\n" +
+    std::to_string(request.CodegenThreads) + "\n" + std::to_string(request.Lazy) + "\n" +
+    std::to_string(request.ProfileGenerate) + "\n" + request.ProfileFile + "\n" +
+    request.ProfileUse + "\n" + request.JITCache + "\n" + std::to_string(request.JITCacheSize) + "\n" +
+    std::to_string(request.Source.size()) + "\n" + std::to_string(request.Input.size()) + "\n";
+  size_t status, outputLength, resultLength;
+  std::string output, result;
+  if (!writeAll(fd, header.data(), header.size()) ||
+      !writeAll(fd, request.Source.data(), request.Source.size()) ||
+      !writeAll(fd, request.Input.data(), request.Input.size()) ||
+      !readNumber(fd, status) || !readNumber(fd, outputLength) || !readNumber(fd, resultLength) ||
+      !readAll(fd, output, outputLength) || !readAll(fd, result, resultLength))
+  {
+    std::cerr << "Error: connection to " << socketPath << " lost" << std::endl;
+    close(fd);
+    return 1;
+  }
+  close(fd);
+
+  std::cout << output << std::flush;
+  if (resultLength > 0)
+  {
+    std::ofstream file(resultFile, std::ios::binary);
+    file.write(result.data(), result.size());
+    if (request.Command == "compile")
+      std::cout << "Wrote " << resultFile << "\n";
+  }
+  return status;
+}
@@ -0,0 +1,42 @@
+/* Compile server: a daemon that keeps LLVM loaded and initialized and
+   compiles or runs programs sent over a Unix domain socket, plus the client
+   side used by -connect. Every request is served by a forked process, so
+   clients are served concurrently and a crashing program only takes its
+   own request down. */
+#ifndef COMPILE_SERVER_H_
+#define COMPILE_SERVER_H_
+
+#include <string>
+
+/* one compile or run; Command is "compile", "emit-llvm" or "run" */
+struct ServerRequest
+{
+  std::string Command;
+  unsigned OptLevel = 2;
+  std::string CPU, Features;
+  std::string Name; /* file name, for messages */
+  std::string Source;
+  std::string Input; /* stdin of a run, empty for none */
+
+  /* the other code generation options of main.cpp; paths are absolute, the
+     server does not run in the directory of the client */
+  bool BoundsChecks = true;
+  unsigned ParallelThreads = 0;
+  unsigned CodegenThreads = 1;
+  bool Lazy = false;
+  bool ProfileGenerate = false;
+  std::string ProfileFile; /* written by -fprofile-generate code */
+  std::string ProfileUse;  /* empty for none */
+  std::string JITCache;    /* empty for none */
+  size_t JITCacheSize = 512 << 20;
+};
+
+/* serves requests on socketPath until killed; returns 1 if it can not listen */
+int runServer(const std::string &socketPath);
+
+/* sends the request, prints the captured output and writes the object or
+   IR to resultFile; returns the exit status of the remote compile or run */
+int runClient(const std::string &socketPath, const ServerRequest &request,
+              const std::string &resultFile);
+
+#endif /* COMPILE_SERVER_H_ */
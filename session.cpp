@@ -0,0 +1,33 @@
+#include "AST.h"
+#include "codegen.h"
+#include "session.h"
+
+CompilationSession::CompilationSession(const std::string &CPU, const std::string &Features)
+  : Context(CPU, Features)
+{
+  Context.setFunctionList(&DefinedFunctions);
+}
+
+CompilationSession::~CompilationSession()
+{
+  ReleaseSource(&Input);
+}
+
+bool CompilationSession::readSource(FILE *f)
+{
+  return ReadSource(&Input, f) == 0;
+}
+
+bool CompilationSession::readSource(const std::string &text)
+{
+  ReleaseSource(&Input);
+  Input = SourceInput();
+  ProgramBlock = nullptr;
+  return ReadSourceText(&Input, text.data(), text.size()) == 0;
+}
+
+bool CompilationSession::parse()
+{
+  // no message here as PrintError() prints the parser errors
+  return ParseSource(*this) == 0 && ProgramBlock && !Input.parseError;
+}
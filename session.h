@@ -0,0 +1,38 @@
+/* A compilation session owns everything one compilation touches: the
+   source buffer and its error state, the scanner and parser (both reentrant),
+   the AST and a Codegen with its own LLVMContext, module and JIT.
+   Sessions share no state, so several of them can compile on different
+   threads of one process. Include AST.h and codegen.h before this file. */
+#ifndef COMPILATION_SESSION_H_
+#define COMPILATION_SESSION_H_
+
+#include <cstdio>
+#include <string>
+#include "error.h"
+
+class CompilationSession
+{
+public:
+  SourceInput Input;
+  ASTArena Arena; /* owns the nodes created by the parser */
+  FunctionMap DefinedFunctions;
+  BlockExprAST *ProgramBlock = nullptr;
+  Codegen Context;
+
+  CompilationSession(const std::string &CPU = "", const std::string &Features = "");
+  ~CompilationSession();
+  CompilationSession(const CompilationSession &) = delete;
+  CompilationSession &operator=(const CompilationSession &) = delete;
+
+  /* reads the whole source; false if it can not be read */
+  bool readSource(FILE *f);
+  /* replaces the source by text, for each input of the REPL */
+  bool readSource(const std::string &text);
+  /* parses the source into ProgramBlock; false on syntax errors */
+  bool parse();
+};
+
+/* runs a scanner and parser of its own over the session's source, see tokens.l */
+extern int ParseSource(CompilationSession &session);
+
+#endif /* COMPILATION_SESSION_H_ */
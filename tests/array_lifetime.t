@@ -0,0 +1,32 @@
+/* arrays are freed when the last variable holding them is gone: the loop
+   allocates 20000 arrays of 1 MB, the same array is kept by first */
+double[] ones(int n) {
+  double[] a = double_array(n);
+  int i;
+  for (i = 0; i < n; i = i + 1) {
+    a[i] = 1.0;
+  }
+  return a;
+}
+
+double[] same(double[] a) {
+  return a;
+}
+
+tailrec double total(double[] a, int k, double sum) {
+  if (k == 0) {
+    return sum;
+  }
+  return total(same(a), k - 1, sum + a[k - 1]);
+}
+
+double[] first = ones(4);
+double s = 0.0;
+int i;
+for (i = 0; i < 20000; i = i + 1) {
+  double[] block = ones(131072);
+  s = s + block[i];
+  first = same(first);
+}
+ones(10);
+println("s = %f, first = %d elements, total = %f", s, first.length, total(first, 4, 0.0));
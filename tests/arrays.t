@@ -0,0 +1,23 @@
+/* int[] and double[] grow on append, a[i] is checked against a.length */
+double mean(double[] values) {
+  int i;
+  double sum = 0.0;
+  for (i = 0; i < values.length; i = i + 1) {
+    sum = sum + values[i];
+  }
+  return sum / values.length;
+}
+
+int[] squares;
+int i;
+for (i = 0; i < 10; i = i + 1) {
+  squares.append(i * i);
+}
+println("squares: %d elements, last %d", squares.length, squares[squares.length - 1]);
+
+double[] x = double_array(5);
+for (i = 0; i < x.length; i = i + 1) {
+  x[i] = i + 0.5;
+}
+x.append(10);
+println("mean = %f", mean(x));
@@ -0,0 +1,16 @@
+/* reads whitespace separated numbers from stdin: a count, that many ints
+   into an array, then doubles up to the end of the input, e.g.
+   printf '3\n1 2 3\n0.5 1.5 2.5' | ./compiler tests/bulk_input.t */
+int n = next_int();
+int[] values = int_array(n);
+int count = read_ints(values);
+int total = 0;
+int i;
+for (i = 0; i < count; i = i + 1) {
+  total = total + values[i];
+}
+println("%d of %d ints, total %d", count, n, total);
+
+double[] rest = read_all_doubles();
+println("%d doubles, sum %f", rest.length, sum(rest));
+println("more input: %d", has_next());
@@ -0,0 +1,18 @@
+/* columns of a CSV file, mapped and parsed into arrays on first use;
+   run from the top of the repository */
+int f = csv_open("tests/csv_columns.csv");
+if (f < 0) {
+  println("can not open tests/csv_columns.csv");
+} else {
+  println("%d rows, %d columns", csv_rows(f), csv_columns(f));
+  double[] close = csv_doubles(f, csv_column(f, "close"));
+  int[] volume = csv_ints(f, csv_column(f, "volume"));
+  double turnover = 0.0;
+  int i;
+  for (i = 0; i < volume.length; i = i + 1) {
+    turnover = turnover + close[i] * volume[i];
+  }
+  println("%s: min %f, max %f", csv_name(f, 2), min(close), max(close));
+  println("turnover %f", turnover);
+  csv_close(f);
+}
@@ -0,0 +1,11 @@
+#include <cstdio>
+
+int fib(int n) {
+  if (n < 2)
+    return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+  printf("fib(32) = %d\n", fib(32));
+}
@@ -0,0 +1,9 @@
+/* doubly recursive calls, nothing for the tail call optimization */
+int fib(int n) {
+  if (n < 2) {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+
+println("fib(32) = %d", fib(32));
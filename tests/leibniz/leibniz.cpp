@@ -0,0 +1,15 @@
+#include <cstdio>
+
+double leibniz(int terms) {
+  double sum = 0.0;
+  double sign = 1.0;
+  for (int k = 0; k < terms; k = k + 1) {
+    sum = sum + sign / (2 * k + 1);
+    sign = -sign;
+  }
+  return 4 * sum;
+}
+
+int main() {
+  printf("pi = %.10f\n", leibniz(100000000));
+}
@@ -0,0 +1,9 @@
+def leibniz(terms):
+  sum = 0.0
+  sign = 1.0
+  for k in range(terms):
+    sum = sum + sign / (2 * k + 1)
+    sign = -sign
+  return 4 * sum
+
+print("pi = %.10f" %(leibniz(100000000)))
@@ -0,0 +1,13 @@
+/* pi by the Leibniz series, a tight floating point loop */
+double leibniz(int terms) {
+  double sum = 0.0;
+  double sign = 1.0;
+  int k;
+  for (k = 0; k < terms; k = k + 1) {
+    sum = sum + sign / (2 * k + 1);
+    sign = -sign;
+  }
+  return 4 * sum;
+}
+
+println("pi = %.10f", leibniz(100000000));
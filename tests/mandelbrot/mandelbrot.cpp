@@ -0,0 +1,45 @@
+#include <cstdio>
+
+double printdensity(double d) {
+  if (d > 8)
+    printf("%c", 32); // ' '
+  else if (d > 4)
+    printf("%c", 46); // '.'
+  else if (d > 2)
+    printf("%c", 43); // '+'
+  else
+    printf("%c", 42); // '*'
+  return d;
+}
+
+int mandelconverger(double real, double imag, int iters, double creal, double cimag) {
+  if (iters > 255)
+    return iters;
+  if (real*real + imag*imag > 4)
+    return iters;
+  return mandelconverger(real*real - imag*imag + creal,
+                         2*real*imag + cimag,
+                         iters+1, creal, cimag);
+}
+
+int mandelconverge(double real, double imag) {
+  return mandelconverger(real, imag, 0, real, imag);
+}
+
+int mandelhelp(double xmin, double xmax, double xstep, double ymin, double ymax, double ystep) {
+  for (double y = ymin; y < ymax; y = y + ystep) {
+    for (double x = xmin; x < xmax; x = x + xstep)
+      printdensity(mandelconverge(x, y));
+    printf("%c", 10);
+  }
+  return 0;
+}
+
+int mandel(double realstart, double imagstart, double realmag, double imagmag) {
+  return mandelhelp(realstart, realstart+realmag*78, realmag,
+                    imagstart, imagstart+imagmag*40, imagmag);
+}
+
+int main() {
+  mandel(-2.3, -1.3, 0.05, 0.07);
+}
@@ -0,0 +1,41 @@
+import sys
+
+def printdensity(d):
+  if d > 8:
+    sys.stdout.write(" ")
+  elif d > 4:
+    sys.stdout.write(".")
+  elif d > 2:
+    sys.stdout.write("+")
+  else:
+    sys.stdout.write("*")
+  return d
+
+def mandelconverger(real, imag, iters, creal, cimag):
+  if iters > 255:
+    return iters
+  if real*real + imag*imag > 4:
+    return iters
+  return mandelconverger(real*real - imag*imag + creal,
+                         2*real*imag + cimag,
+                         iters+1, creal, cimag)
+
+def mandelconverge(real, imag):
+  return mandelconverger(real, imag, 0, real, imag)
+
+def mandelhelp(xmin, xmax, xstep, ymin, ymax, ystep):
+  y = ymin
+  while y < ymax:
+    x = xmin
+    while x < xmax:
+      printdensity(mandelconverge(x, y))
+      x = x + xstep
+    sys.stdout.write("\n")
+    y = y + ystep
+  return 0
+
+def mandel(realstart, imagstart, realmag, imagmag):
+  return mandelhelp(realstart, realstart+realmag*78, realmag,
+                    imagstart, imagstart+imagmag*40, imagmag)
+
+mandel(-2.3, -1.3, 0.05, 0.07)
@@ -0,0 +1,19 @@
+/* print, println, printi and printd write into a buffer of the runtime,
+   flushed by flush() and at exit; output_file and output_stdout select
+   where it goes */
+printi(42);
+printd(0.1);
+printr(0.1);
+printr(1.0 / 3.0);
+println("%d %c %s %.2f %e %g %%", 7, 65, "text", 3.14159, 1234.5, 0.0001);
+println("%5d|%x", 42, 255);
+flush();
+
+if (output_file("output.txt") == 0) {
+  int i;
+  for (i = 0; i < 3; i = i + 1) {
+    println("line %d in the file", i);
+  }
+  output_stdout();
+}
+println("back on stdout");
@@ -0,0 +1,27 @@
+/* parallel for loops run chunks of the iterations on the thread pool;
+   run with -threads N to choose the number of threads */
+double term(int k) {
+  double sign = 1.0;
+  if (k - (k / 2) * 2 == 1) {
+    sign = -1.0;
+  }
+  return sign / (2 * k + 1);
+}
+
+int n = 10000000;
+int i;
+double pi4 = 0.0;
+parallel for (i = 0; i < n; i = i + 1) reduce(+: pi4) {
+  pi4 = pi4 + term(i);
+}
+println("pi = %f, i = %d", 4 * pi4, i);
+
+double[] squares = double_array(1000);
+int lo = 1000000;
+int hi = 0;
+parallel for (i = 0; i <= 999; i = i + 1) reduce(min: lo, max: hi) {
+  squares[i] = i * i;
+  lo = i;
+  hi = i;
+}
+println("squares: %f, indexes from %d to %d", sum(squares), lo, hi);
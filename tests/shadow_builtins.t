@@ -0,0 +1,17 @@
+/* a program may define functions named like the vector kernels,
+   its own max and sum are called instead */
+double max(double a, double b) {
+  if (a > b) {
+    return a;
+  }
+  return b;
+}
+
+int sum(int n) {
+  if (n == 0) {
+    return 0;
+  }
+  return n + sum(n - 1);
+}
+
+println("max = %f, sum = %d", max(2.5, 1.5), sum(10));
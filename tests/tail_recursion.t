@@ -0,0 +1,17 @@
+/* self calls in tail position are compiled to loops */
+tailrec int gcd(int a, int b) {
+  if (b == 0) {
+    return a;
+  }
+  return gcd(b, a - (a / b) * b);
+}
+
+tailrec double harmonic(int n, double sum) {
+  if (n == 0) {
+    return sum;
+  }
+  return harmonic(n - 1, sum + 1.0 / n);
+}
+
+println("gcd(1071, 462) = %d", gcd(1071, 462));
+println("harmonic(10000000) = %f", harmonic(10000000, 0.0));
@@ -0,0 +1,26 @@
+/* sum, dot, axpy, scale, min, max, prefix_sum and the element-wise vsin,
+   vcos and vsqrt run on SIMD kernels of the runtime */
+int n = 1000;
+int i;
+double[] x = double_array(n);
+double[] y = double_array(n);
+for (i = 0; i < n; i = i + 1) {
+  x[i] = i + 1;
+  y[i] = 1.0;
+}
+
+println("sum = %f, dot = %f", sum(x), dot(x, y));
+axpy(2.0, x, y);
+println("after axpy: y[0] = %f, y[999] = %f", y[0], y[n - 1]);
+scale(y, 0.5);
+println("min = %f, max = %f", min(y), max(y));
+prefix_sum(y);
+println("prefix sum: %f", y[n - 1]);
+
+vsqrt(x);
+println("sqrt: %f %f", x[3], x[99]);
+double[] angles = double_array(3);
+angles[1] = pi() / 6;
+angles[2] = pi() / 3;
+vsin(angles);
+println("sin: %f %f %f", angles[0], angles[1], angles[2]);